@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
@@ -21,7 +22,7 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
  *******************************************************/
@@ -71,6 +72,15 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+/* Return the raw value of the cycle counter. */
+unsigned long long read_cycles()
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long) hi << 32) | lo;
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -160,6 +170,20 @@ double get_counter()
 }
 #endif
 
+#if !defined(__i386__) && !defined(__x86_64__)
+/*
+ * Without a cycle counter we can read from user code, read_cycles()
+ * counts nanoseconds of the monotonic clock instead.
+ */
+unsigned long long read_cycles()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+
 
 
 
@@ -179,6 +203,38 @@ double ovhd()
     return result;
 }
 
+/* Overhead of timing an event with a pair of read_cycles() calls:
+   the least of many back-to-back pairs */
+unsigned long long cycles_ovhd()
+{
+    int i;
+    unsigned long long start, d, best = ~0ULL;
+
+    for (i = 0; i < 10000; i++) {
+	start = read_cycles();
+	d = read_cycles() - start;
+	if (d < best)
+	    best = d;
+    }
+    return best;
+}
+
+/* Rate of read_cycles() in counts per nanosecond, measured against the
+   monotonic clock over 20 ms. On x86 this is the TSC rate, which need
+   not be the rate the core is running at. */
+double cycles_per_nsec()
+{
+    struct timespec t0, t1, nap = {0, 20000000};
+    unsigned long long c0, c1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = read_cycles();
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = read_cycles();
+    return (c1 - c0) / (1e9*(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec));
+}
+
 /* $begin mhz */
 /* Estimate the clock rate by measuring the cycles that elapse */ 
 /* while sleeping for sleeptime seconds */
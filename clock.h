@@ -9,6 +9,15 @@ double get_counter();
 /* Measure overhead for counter */
 double ovhd();
 
+/* Read the counter directly, for timing short events */
+unsigned long long read_cycles();
+
+/* Overhead of timing an event with two read_cycles() calls */
+unsigned long long cycles_ovhd();
+
+/* Rate of read_cycles() in counts per nanosecond */
+double cycles_per_nsec();
+
 /* Determine clock rate of processor (using a default sleeptime) */
 double mhz(int verbose);
 
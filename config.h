@@ -56,11 +56,14 @@
  */
 #define ALIGNMENT 16
 
-/*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
- *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
-#define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+/*
+ * The timer fsecs uses unless mdriver's --timer picks another:
+ *   "gettod"  gettimeofday, averaged over 10 runs (any Unix box)
+ *   "itimer"  interval timer, averaged over 10 runs (any Unix box)
+ *   "fcyc"    cycle counter w/K-best scheme (x86 & Alpha only)
+ *   "clock"   clock_gettime(CLOCK_MONOTONIC) around each run
+ *   "cycles"  read_cycles() around each run
+ */
+#define DEFAULT_TIMER "clock"
 
 #endif /* __CONFIG_H */
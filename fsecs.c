@@ -2,16 +2,75 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+#define MAX_SAMPLES 1000 /* most samples fsecs_stats will take */
+
+/* The timers fsecs can use */
+enum {GETTOD, ITIMER, FCYC, CLOCK, CYCLES};
+static const char *timer_names[] = {"gettod", "itimer", "fcyc", "clock", "cycles"};
+
 static double Mhz;  /* estimated CPU clock frequency */
+static double cyc_per_sec; /* rate of read_cycles() */
+static int timer = -1;     /* set_fsecs_timer, else DEFAULT_TIMER */
+static int warmup = 1;
+static int min_samples = 10;
+static int max_samples = 30;
+static double target_ci = 0.02;
 
 extern int verbose; /* -v option in mdriver.c */
 
+/*
+ * set_fsecs_timer - choose the timer by name; call before init_fsecs
+ */
+int set_fsecs_timer(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(timer_names)/sizeof(timer_names[0]); i++)
+	if (strcmp(name, timer_names[i]) == 0) {
+	    timer = i;
+	    return 0;
+	}
+    return -1;
+}
+
+/*
+ * fsecs_timer - the name of the timer in use
+ */
+const char *fsecs_timer(void)
+{
+    if (timer < 0)
+	set_fsecs_timer(DEFAULT_TIMER);
+    return timer_names[timer];
+}
+
+void set_fsecs_warmup(int runs)
+{
+    warmup = runs;
+}
+
+void set_fsecs_samples(int min, int max)
+{
+    min_samples = min < 2 ? 2 : min;
+    max_samples = max < min_samples ? min_samples : max;
+    if (max_samples > MAX_SAMPLES)
+	max_samples = MAX_SAMPLES;
+}
+
+void set_fsecs_ci(double ci)
+{
+    target_ci = ci;
+}
+
 /*
  * init_fsecs - initialize the timing package
  */
@@ -19,39 +78,128 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+    fsecs_timer(); /* settle on the default if none was chosen */
+    switch (timer) {
+    case FCYC:
+	if (verbose)
+	    printf("Measuring performance with a cycle counter.\n");
+
+	/* set key parameters for the fcyc package */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_compensate(1);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = mhz(verbose > 0);
+	break;
+    case ITIMER:
+	if (verbose)
+	    printf("Measuring performance with the interval timer.\n");
+	break;
+    case GETTOD:
+	if (verbose)
+	    printf("Measuring performance with gettimeofday().\n");
+	break;
+    case CLOCK:
+	if (verbose)
+	    printf("Measuring performance with clock_gettime().\n");
+	break;
+    case CYCLES:
+	cyc_per_sec = cycles_per_nsec() * 1e9;
+	if (verbose)
+	    printf("Measuring performance with read_cycles() at %.0f MHz.\n",
+		   cyc_per_sec / 1e6);
+	break;
+    }
 }
 
 /*
- * fsecs - Return the running time of a function f (in seconds)
+ * fsecs - Return the running time of a function f (in seconds). The
+ *     interval timer and gettimeofday are too coarse to time one run,
+ *     so they average 10; the others time a single run.
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
+    struct timespec start, end;
+    unsigned long long cyc;
+
+    switch (timer) {
+    case FCYC:
+	return fcyc(f, argp)/(Mhz*1e6);
+    case ITIMER:
+	return ftimer_itimer(f, argp, 10);
+    case CLOCK:
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) + 1e-9*(end.tv_nsec - start.tv_nsec);
+    case CYCLES:
+	cyc = read_cycles();
+	f(argp);
+	return (read_cycles() - cyc) / cyc_per_sec;
+    default:
+	return ftimer_gettod(f, argp, 10);
+    }
 }
 
+/*
+ * t95 - Two-sided 95% quantile of Student's t with df degrees of freedom
+ */
+static double t95(int df)
+{
+    static const double t[] = {
+	0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+	2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+	2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+	2.042
+    };
+
+    if (df < sizeof(t)/sizeof(t[0]))
+	return t[df];
+    return 1.960 + 2.4/df; /* within 0.005 beyond 30 */
+}
 
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * fsecs_stats - Time f repeatedly with fsecs after some warmup runs and
+ *     summarize the samples in st. Like the K-best scheme of fcyc, it
+ *     keeps sampling until the result settles: here, until the 95%
+ *     confidence interval of the mean is tight enough. Returns the
+ *     median, which a stray slow sample doesn't move.
+ */
+double fsecs_stats(fsecs_test_funct f, void *argp, fsecs_stats_t *st)
+{
+    static double secs[MAX_SAMPLES];
+    double sum = 0, sumsq = 0, mean, var;
+    int i, n;
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+
+    for (n = 0; n < max_samples; ) {
+	secs[n] = fsecs(f, argp);
+	sum += secs[n];
+	sumsq += secs[n] * secs[n];
+	n++;
+	if (n < min_samples)
+	    continue;
+	mean = sum / n;
+	var = (sumsq - n*mean*mean) / (n - 1);
+	st->stddev = var > 0 ? sqrt(var) : 0;
+	st->ci = t95(n - 1) * st->stddev / sqrt(n);
+	if (st->ci <= target_ci * mean)
+	    break;
+    }
+
+    qsort(secs, n, sizeof(double), cmp_double);
+    st->samples = n;
+    st->mean = sum / n;
+    st->min = secs[0];
+    st->median = n % 2 ? secs[n/2] : (secs[n/2 - 1] + secs[n/2]) / 2;
+    return st->median;
+}
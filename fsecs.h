@@ -1,4 +1,28 @@
 typedef void (*fsecs_test_funct)(void *);
 
+/* Summary of the samples fsecs_stats took, in seconds per run of f */
+typedef struct {
+    double median;
+    double min;
+    double mean;
+    double stddev;
+    double ci;       /* half-width of the 95% confidence interval of the mean */
+    int samples;
+} fsecs_stats_t;
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_stats(fsecs_test_funct f, void *argp, fsecs_stats_t *st);
+
+/* Timer: "gettod", "itimer", "fcyc", "clock" or "cycles"; -1 if unknown */
+int set_fsecs_timer(const char *name);
+const char *fsecs_timer(void);
+
+/* Untimed runs of f before fsecs_stats starts sampling. Default 1 */
+void set_fsecs_warmup(int runs);
+
+/* fsecs_stats takes at least min samples, then more until the
+   confidence interval is within ci (a fraction of the mean) of the
+   mean or it has max samples. Defaults 10, 30 and 0.02 */
+void set_fsecs_samples(int min, int max);
+void set_fsecs_ci(double ci);
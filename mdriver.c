@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,13 +16,26 @@
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <sched.h>
+#include <pthread.h>
+#include <malloc.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "pagemap.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "perfctr.h"
 #include "config.h"
 
 /**********************
@@ -33,6 +47,91 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Binary trace files (made by traces/rep2bin.pl) start with this */
+#define BIN_MAGIC   "MMTRACE\x01"
+
+/* glibc 2.33 and later report the heap in size_t (-l util) */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define HAVE_MALLINFO2
+#endif
+
+/* Trace analysis (--analyze) */
+#define ANA_BUCKETS   65  /* power-of-two buckets, with 0 in one of its own */
+#define ANA_RATIOS     8  /* buckets of realloc growth */
+#define ANA_TOP_SIZES 16  /* exact sizes listed in the printed summary */
+
+/* Most threads in a trace's thread column */
+#define MAX_THREADS 1024
+
+/* Streaming replay (-F) */
+#define STREAM_WINDOW  4096  /* ops the parser thread hands over at a time */
+#define STREAM_WINDOWS    8  /* windows in the ring between the threads */
+#define IDMAP_MIN      1024  /* initial slots in the id map */
+
+/* Size distributions of the synthetic trace generator (--generate) */
+#define GEN_UNIFORM    0  /* uniform:lo:hi */
+#define GEN_LOGNORMAL  1  /* lognormal:median:sigma */
+#define GEN_ZIPF       2  /* zipf:s:classes, power-of-two classes from 16 bytes */
+#define GEN_BIMODAL    3  /* bimodal:small:large:p */
+#define GEN_CLASSES   32  /* most zipf size classes */
+
+/* ... and its lifetime models */
+#define GEN_EXP        0  /* exponential, with a mean that meets the live target */
+#define GEN_LIFO       1  /* free the youngest block */
+#define GEN_FIFO       2  /* free the oldest block */
+
+/* Scaling sweep (--sweep) */
+#define SWEEP_OPS         4  /* ops per block of the live-set target */
+#define SWEEP_POINTS     64  /* most points in a sweep */
+#define SWEEP_MIN_SECS  0.2  /* repeat a point until it has run this long */
+#define SWEEP_MAX_SECS   60  /* stop after a point that runs longer */
+#define SWEEP_SLACK    0.15  /* growth exponent above 1 that is super-linear */
+
+/* Range records malloc'd at a time */
+#define RANGE_SLAB  4096
+
+/* snap_op value that snapshots the heap at its peak size */
+#define SNAP_PEAK  -2
+
+/* Shape of the false-sharing microbenchmark (-X) */
+#define XBLOCKS     256  /* blocks each thread allocates */
+#define XSIZE        24  /* bytes per block */
+#define XROUNDS   20000  /* passes each thread makes over its blocks */
+#define XLINE        64  /* cache line size */
+
+/* Per-op latency (-L) */
+#define LAT_OPS         3  /* ALLOC, FREE and REALLOC */
+#define LAT_SIZES       5  /* request size classes: <=64, <=512, <=4K, <=32K, more */
+#define HIST_SUB_BITS   3  /* each power of two splits into 2^3 buckets */
+#define HIST_SUB       (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* Long options, which have no short equivalents */
+enum {
+    OPT_JSON = 256,
+    OPT_CSV,
+    OPT_BASELINE,
+    OPT_TOLERANCE,
+    OPT_UTIL_TOLERANCE,
+    OPT_TIMER,
+    OPT_WARMUP,
+    OPT_SAMPLES,
+    OPT_CI,
+    OPT_CPU,
+    OPT_TIMELINE,
+    OPT_TIMELINE_BIN,
+    OPT_TOUCH,
+    OPT_TOUCH_EVERY,
+    OPT_GENERATE,
+    OPT_SWEEP,
+    OPT_CONCURRENT,
+    OPT_ANALYZE
+};
+
+/* Footprint timelines (--timeline, --timeline-bin) */
+#define TIMELINE_MAGIC  "MMTLINE\x01"
+
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -40,26 +139,152 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records of a trace
+ * form a treap: a binary search tree on lo that is also a heap on prio.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* random heap priority */
+    struct range_t *left;  /* payloads below this one */
+    struct range_t *right; /* payloads above this one (next in the pool) */
 } range_t;
 
+/* Header of a binary trace file; op records follow it */
+typedef struct {
+    char magic[8];           /* BIN_MAGIC */
+    uint64_t sugg_heapsize;  /* suggested heap size (unused) */
+    uint64_t num_ids;        /* number of alloc/realloc ids */
+    uint64_t num_ops;        /* number of distinct requests */
+    uint64_t weight;         /* weight for this trace (unused) */
+    uint64_t data_bytes;     /* bytes of op records */
+} bin_header_t;
+
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
     enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int thread;                       /* thread that made it (0 if untold) */
 } traceop_t;
 
+/* One op of a streamed trace, with 64-bit ids and sizes */
+typedef struct {
+    int type;        /* ALLOC, FREE or REALLOC */
+    uint64_t id;     /* id for free() to use later */
+    uint64_t size;   /* byte size of alloc/realloc request */
+} streamop_t;
+
+/* A live block of a generated trace */
+typedef struct {
+    double due;      /* blocks are freed in order of due; HUGE_VAL at the end */
+    uint64_t id;
+    uint64_t size;
+} genblock_t;
+
+/* A synthetic trace model (--generate) and where it has got to */
+typedef struct {
+    uint64_t ops;             /* ops to generate before freeing what's left */
+    uint64_t live_target;     /* payload bytes to keep allocated */
+    int size_dist;            /* GEN_UNIFORM ... GEN_BIMODAL */
+    double size_arg[3];       /* the distribution's parameters */
+    double zipf_cdf[GEN_CLASSES];
+    int life;                 /* GEN_EXP, GEN_LIFO or GEN_FIFO */
+    double long_lived;        /* fraction of blocks that live to the end */
+    double mean_size;         /* estimated from draws */
+    double mean_life;         /* mean GEN_EXP lifetime in ops */
+    uint64_t seed;
+    uint64_t rng;             /* xorshift64* state */
+    uint64_t now;             /* ops generated */
+    uint64_t next_id;
+    uint64_t live;            /* payload bytes allocated */
+    genblock_t *heap;         /* live blocks, a min-heap on due */
+    size_t count, max;
+} gen_t;
+
+/* One point of a scaling sweep */
+typedef struct {
+    uint64_t blocks;          /* live-set target in blocks */
+    uint64_t ops;             /* ops replayed, the final frees included */
+    double secs;              /* best time in mm calls */
+    uint64_t max_live;        /* peak payload bytes */
+    uint64_t max_blocks;      /* peak live blocks */
+    size_t max_heap;          /* peak heap bytes */
+} sweep_t;
+
+/* A run of ops handed from the parser thread to the replay loop */
+typedef struct {
+    streamop_t ops[STREAM_WINDOW];
+    int count;       /* ops in the window; less than STREAM_WINDOW at the end */
+} window_t;
+
+/* A trace being streamed: the parser thread fills windows, replay drains them */
+typedef struct {
+    FILE *in;
+    char *name;
+    int binary;               /* binary trace format */
+    gen_t *gen;               /* ops come from this model rather than in */
+    uint64_t num_ids;         /* from the header, for the report only */
+    uint64_t num_ops;
+    uint64_t parsed;          /* ops parsed so far (parser thread only) */
+    window_t *windows;        /* STREAM_WINDOWS of them */
+    long filled, drained;     /* windows handed over and used up so far */
+    int done;                 /* parser reached the end (1) or bad input (-1) */
+    volatile int stop;        /* replay gave up; the parser should too */
+    char error[MAXLINE];      /* what was wrong with the input */
+    pthread_mutex_t lock;     /* guards filled, drained and done */
+    pthread_cond_t changed;   /* signalled when one of them changes */
+} stream_t;
+
+/* Slot of the sparse map from a streamed op's id to its live block */
+typedef struct {
+    uint64_t id;
+    char *p;         /* the block, or NULL if the slot is empty */
+    uint64_t size;   /* its payload size */
+    uint64_t born;   /* op that allocated it (--analyze) */
+} idslot_t;
+
+/* Open-addressed hash table of idslots, sized to the live set */
+typedef struct {
+    idslot_t *slots;
+    size_t mask;     /* number of slots - 1 */
+    size_t count;    /* slots in use */
+} idmap_t;
+
+/* Exact request sizes and how often each was asked for (--analyze) */
+typedef struct {
+    uint64_t *keys;  /* size + 1, or 0 if the slot is empty */
+    uint64_t *counts;
+    size_t mask;     /* number of slots - 1 */
+    size_t count;    /* slots in use */
+} sizecount_t;
+
+/* What --analyze has found in a trace so far */
+typedef struct {
+    uint64_t ops, allocs, reallocs, frees;
+    uint64_t live, max_live;      /* payload bytes */
+    uint64_t max_blocks, peak_op;
+    uint64_t blocks_left;         /* live at the end */
+    uint64_t size_pow2[ANA_BUCKETS]; /* alloc and realloc sizes */
+    sizecount_t sizes;
+    uint64_t life_pow2[ANA_BUCKETS]; /* ops from alloc to free */
+    double life_sum;
+    uint64_t ratios[ANA_RATIOS];  /* realloc new size / old size */
+    double log_ratio_sum;         /* ... for the geometric mean */
+    uint64_t log_ratios;
+    uint64_t lifo_frees;          /* frees of the youngest live block */
+    uint64_t *stack;              /* id, born pairs in order of birth; */
+    size_t stack_count, stack_max;/* ... dead ones are popped lazily */
+} analysis_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* threads named in the trace's thread column */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
@@ -73,27 +298,214 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    long minflt, majflt; /* page faults taken while replaying... */
+    unsigned long long reserve_ticks; /* ... counter ticks in mm_reserve ... */
+    int runs;            /* ... summed over this many runs */
+    unsigned long long touch_ticks; /* counter ticks spent touching blocks */
+    int touch_runs;      /* ... summed over this many runs */
+    int failed_op;       /* op a timed run ran out of memory at, or -1 */
 } speed_t;
 
+/* State shared by the threads of the false-sharing microbenchmark */
+typedef struct {
+    int nthreads;
+    int turn;                 /* allocations so far; turn % nthreads goes next */
+    pthread_mutex_t lock;     /* guards mm and turn */
+    pthread_cond_t next;      /* signalled when turn changes */
+    pthread_barrier_t start;  /* releases the write phase */
+    char **blocks;            /* XBLOCKS blocks per thread */
+} xshare_t;
+
+/* One thread's view of it */
+typedef struct {
+    xshare_t *share;
+    int id;
+} xthread_t;
+
+/* A block of the false-sharing microbenchmark and the thread it is for */
+typedef struct {
+    char *p;
+    int owner;
+} xblock_t;
+
+/* Result of one run of the false-sharing microbenchmark */
+typedef struct {
+    double mwrites;  /* million block writes per second */
+    double util;     /* payload bytes / heap bytes */
+    int shared;      /* cache lines holding blocks of two threads */
+} xresult_t;
+
+/* 
+ * Histogram of op latencies in counter ticks. Values below HIST_SUB
+ * have buckets of their own; above that, each power of two is split
+ * into HIST_SUB buckets, so a bucket is within 1/HIST_SUB of its values.
+ */
+typedef struct {
+    long count;
+    unsigned long long max;
+    long buckets[HIST_BUCKETS];
+} hist_t;
+
+/* What the workers of a concurrent replay (--concurrent) share */
+typedef struct {
+    trace_t *trace;
+    int libc;                 /* libc malloc rather than mm */
+    int *first;               /* each thread's first request, or -1 */
+    int *next;                /* its thread's next request after each, or -1 */
+    int *dep;                 /* another thread's request each waits for, or -1 */
+    char *done;               /* requests carried out */
+    int failed;               /* an allocation failed; everyone stops */
+    pthread_mutex_t mm_lock;  /* serializes calls into mm */
+    pthread_barrier_t start;  /* lets the workers go at once */
+} creplay_t;
+
+/* A worker of a concurrent replay, carrying out one trace thread */
+typedef struct {
+    creplay_t *share;
+    int thread;
+    pthread_t tid;
+    hist_t hist;                /* counter ticks per request */
+    unsigned long long waited;  /* ... spent waiting on other threads */
+    double secs;                /* from the start to its last request */
+} cworker_t;
+
+/* Percentiles of the per-op latency of one run of a trace, in nsecs */
+typedef struct {
+    long count;      /* ops measured */
+    double p50, p99, p999, max;
+    size_t peak_heap;    /* mm's largest heap over the run (0 for libc) */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
+    double secs;     /* number of secs needed to run the trace (median) */
+    double secs_min; /* fastest timed sample */
+    double secs_sd;  /* standard deviation of the samples */
+    double noise;    /* 95% confidence interval of the mean, relative to it */
+    int samples;     /* timed samples taken */
+    double util;     /* overall space utilization for this trace */
+
+    double inst_util;     /* instanteous space utilization for this trace */
 
     /* defined only for the student malloc package */
-    double util;     /* overall space utilization for this trace (always 0 for libc) */
+    double minflt;   /* minor page faults per timed run */
+    double majflt;   /* major page faults per timed run */
+    double reserve_secs; /* mm_reserve per timed run, left out of secs (-R) */
+
+    /* where the bytes of the heap went when it was at its largest */
+    size_t foot_heap;     /* mapped bytes (libc too) */
+    size_t foot_payload;  /* bytes requested by the trace (libc too) */
+    size_t foot_slack;    /* usable bytes beyond the request (rounding) */
+    size_t foot_header;   /* block headers and footers */
+    size_t foot_free;     /* free blocks */
+    size_t foot_chunk;    /* chunk sentinels and terminators */
+
+    /* the footprint over the whole trace, each op one unit of time (libc too) */
+    double heap_area;     /* sum over ops of mapped bytes */
+    double live_area;     /* sum over ops of payload bytes */
+    size_t heap_p95;      /* mapped bytes that 95% of ops stay within */
+
+    /* defined only under an address-space limit (-M) */
+    size_t peak_heap;     /* most bytes mapped at once over all passes */
+    int reclaims;         /* times mm_malloc fell back on mdriver's hook */
 
-    double inst_util;     /* instanteous space utilization for this trace (always 0 for libc) */
+    /* defined only when mm_trim is exercised (-T) */
+    size_t trim_heap[2];  /* mapped bytes before and after mm_trim */
+    size_t trim_rss[2];   /* resident bytes before and after mm_trim */
+    size_t trim_released; /* bytes mm_trim reported as released */
+
+    /* defined only when the heap profiler is exercised (-P) */
+    double prof_secs;     /* secs needed to run the trace while sampling */
+
+    /* defined only when per-op latency is measured (-B) */
+    latency_t lat[2];     /* with the background thread off and on */
+
+    /* defined only for the memory-touch workload (--touch) */
+    double touch_secs;    /* secs to run the trace while touching blocks */
+    double touch_part;    /* secs of that spent touching */
+
+    /* defined only when hardware events are counted (-C) */
+    double ctr[PC_EVENTS]; /* events per op; -1 where not counted */
+
+    /* defined only when per-op latency is broken down (-L) */
+    latency_t oplat[LAT_OPS][LAT_SIZES]; /* by op type and request size */
+    latency_t alllat;                    /* over all ops */
 
     /* Note: secs and util are only defined if valid is true */
-} stats_t; 
+} stats_t;
+
+/* What eval_libc_util hands the thread it runs the trace on */
+typedef struct {
+    trace_t *trace;
+    stats_t *stats;      /* shared with the parent */
+    size_t *heap_sizes;  /* room for one per op */
+} libc_util_t;
+
+/* 
+ * One record of a binary timeline, in the machine's byte order. The
+ * file is TIMELINE_MAGIC followed by records; a CSV timeline has the
+ * same columns.
+ */
+typedef struct {
+    uint64_t op;     /* index of the op just done */
+    uint64_t live;   /* payload bytes allocated */
+    uint64_t heap;   /* bytes mapped */
+    uint64_t free;   /* bytes in free blocks */
+    uint64_t chunks; /* chunks in the heap */
+} timeline_t;
+
+/* One trace's results in a --baseline file */
+typedef struct {
+    char trace[MAXLINE];
+    int valid;
+    double ops, secs, util; /* secs is the fastest sample, if recorded */
+} base_t;
+
+/* What a -j worker sends back over the results pipe */
+typedef struct {
+    int tracenum;
+    int errors;      /* malloc_error calls in the worker */
+    stats_t stats;
+} result_t;
+
+/* Evaluates one trace, serially or in a -j worker */
+typedef void (*trace_fn)(trace_t *trace, int tracenum, stats_t *stats); 
 
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int run_trim = 0;/* call mm_trim at each trace's live peak (-T) */
+static size_t prof_rate = 0; /* heap profiler sampling rate in bytes (-P) */
+static int run_background = 0; /* compare latency with mm's background thread (-B) */
+static int run_latency = 0;     /* per-op latency by op type and size (-L) */
+static int run_counters = 0;    /* hardware events per op (-C) */
+static int timeline_every = 0;  /* write the footprint every nth op (--timeline) */
+static int timeline_bin = 0;    /* ... in binary rather than CSV */
+static size_t touch_bytes = 0;  /* bytes of each block touched per op (--touch) */
+static int touch_every = 0;     /* ops between walks of the live blocks (--touch-every) */
+static volatile unsigned long touch_sink; /* keeps the reads from being optimized out */
+static unsigned long long cyc_ovhd = 0; /* counter ticks of timing an empty op */
+static double cyc_per_ns = 1.0;         /* counter ticks per nsec */
+static size_t as_headroom = 0;  /* address space left to mm under RLIMIT_AS (-M) */
+static size_t reserve_bytes = 0;/* prefaulted bytes to mm_reserve per run (-R) */
+static int xthreads = 0;        /* threads in the false-sharing benchmark (-X) */
+static int snap_op = -1;        /* op after which to snapshot the heap (-S) */
+static char *stream_file = NULL;/* trace to stream through mm, "-" for stdin (-F) */
+static char *gen_spec = NULL;   /* model of a trace to generate and stream (--generate) */
+static char *sweep_range = NULL;/* live blocks to sweep the model over (--sweep) */
+static int run_concurrent = 0;  /* replay each trace's threads at once (--concurrent) */
+static int run_analyze = 0;     /* analyze the -F or --generate trace (--analyze) */
+static int jobs = 1;            /* traces evaluated at once (-j) */
+static int timing_fd = -1;      /* -j: file whose lock is the right to time */
+static char *json_file = NULL;  /* write the results here as JSON (--json) */
+static char *csv_file = NULL;   /* ... and as CSV (--csv) */
+static char *baseline_file = NULL; /* results to check this run against (--baseline) */
+static double thru_tolerance = 5.0; /* % drop in total Kops that --baseline allows */
+static double util_tolerance = 0.5; /* points of util drop that --baseline allows */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -110,31 +522,80 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+/* these functions manipulate range trees */
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, long opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_bin_trace(trace_t *trace, int fd, char *path);
+static void alloc_trace(trace_t *trace);
+static int eval_mm_stream(char *filename, char *spec);
+static int eval_mm_sweep(char *range, char *spec);
+static int eval_concurrent(trace_t *trace, char *name, int libc);
+static int eval_analyze(char *filename, char *spec);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
+static void eval_libc_util(trace_t *trace, stats_t *stats);
 static void eval_libc_speed(void *ptr);
+static void time_speed(fsecs_test_funct f, speed_t *params, stats_t *stats);
+static void count_events(fsecs_test_funct f, speed_t *params, stats_t *stats);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void eval_libc_trace(trace_t *trace, int tracenum, stats_t *stats);
+static void eval_mm_trace(trace_t *trace, int tracenum, stats_t *stats);
+static void run_parallel(trace_fn fn, int njobs, char **tracefiles, int n,
+			 stats_t *stats);
+static void timing_begin(void);
+static void timing_end(void);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats);
+static int peak_live_op(trace_t *trace);
+static void replay_prefix(trace_t *trace, int last_op);
+static void eval_mm_trim(trace_t *trace, stats_t *stats);
+static void snapshot(int tracenum);
+static FILE *timeline_open(int tracenum);
+static void timeline_put(FILE *f, int op, size_t live, size_t heap);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_touch(void *ptr);
+static void eval_libc_touch(void *ptr);
+static void time_touch(fsecs_test_funct f, trace_t *trace, stats_t *stats);
+static unsigned long long ticks_since(unsigned long long start);
+static void eval_latency(trace_t *trace, int libc, int background,
+			 latency_t *all, latency_t oplat[LAT_OPS][LAT_SIZES]);
+static void eval_false_sharing(int nthreads, int lines, xresult_t *res);
+static void *xthread_main(void *arg);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printtrim(int n, stats_t *stats);
+static void printfootprint(int n, stats_t *stats);
+static void printspace(int n, stats_t *libc_stats, stats_t *mm_stats);
+static void json_string(FILE *f, const char *s);
+static void printsustained(int n, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
+static void printprof(int n, stats_t *stats);
+static void write_results(char *path, int csv, char **tracefiles, int n,
+			  stats_t *libc_stats, stats_t *mm_stats, double perfindex);
+static int check_baseline(char *path, char **tracefiles, int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printoplatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printtiming(int n, stats_t *stats);
+static void printlimit(int n, stats_t *stats);
+static void printfaults(int n, stats_t *stats);
+static void pin_cpu(int slot);
+static void limit_address_space(size_t headroom);
+static size_t count_reclaim(size_t bytes, void *arg);
 static void usage(void);
+static size_t opt_count(char *opt, char *arg, size_t min, size_t max);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, long opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -142,15 +603,13 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    trace_t **traces = NULL;   /* traces read by the libc pass, or NULL */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
@@ -159,12 +618,102 @@ int main(int argc, char **argv)
     double secs, ops, util, inst_util, avg_mm_inst_util, avg_mm_util, avg_mm_throughput;
     double p1, p1i, p2, perfindex;
     int numcorrect;
+
+    static struct option long_options[] = {
+	{"json", required_argument, NULL, OPT_JSON},
+	{"csv", required_argument, NULL, OPT_CSV},
+	{"baseline", required_argument, NULL, OPT_BASELINE},
+	{"tolerance", required_argument, NULL, OPT_TOLERANCE},
+	{"util-tolerance", required_argument, NULL, OPT_UTIL_TOLERANCE},
+	{"timer", required_argument, NULL, OPT_TIMER},
+	{"warmup", required_argument, NULL, OPT_WARMUP},
+	{"samples", required_argument, NULL, OPT_SAMPLES},
+	{"ci", required_argument, NULL, OPT_CI},
+	{"cpu", required_argument, NULL, OPT_CPU},
+	{"timeline", required_argument, NULL, OPT_TIMELINE},
+	{"timeline-bin", required_argument, NULL, OPT_TIMELINE_BIN},
+	{"touch", required_argument, NULL, OPT_TOUCH},
+	{"touch-every", required_argument, NULL, OPT_TOUCH_EVERY},
+	{"generate", required_argument, NULL, OPT_GENERATE},
+	{"sweep", required_argument, NULL, OPT_SWEEP},
+	{"concurrent", no_argument, NULL, OPT_CONCURRENT},
+	{"analyze", no_argument, NULL, OPT_ANALYZE},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+    };
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:F:j:t:hvVgaClLTP:BM:R:S:X:",
+			    long_options, NULL)) != EOF) {
         switch (c) {
+	case OPT_JSON: /* Write the results to a JSON file */
+	    json_file = optarg;
+	    break;
+	case OPT_CSV: /* Write the results to a CSV file */
+	    csv_file = optarg;
+	    break;
+	case OPT_BASELINE: /* Fail if worse than the results in a JSON file */
+	    baseline_file = optarg;
+	    break;
+	case OPT_TOLERANCE: /* % throughput drop that --baseline allows */
+	    thru_tolerance = atof(optarg);
+	    break;
+	case OPT_UTIL_TOLERANCE: /* Points of util drop that --baseline allows */
+	    util_tolerance = atof(optarg);
+	    break;
+	case OPT_TIMER: /* Time runs with this timer */
+	    if (set_fsecs_timer(optarg) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_WARMUP: /* Untimed runs of each trace before sampling */
+	    set_fsecs_warmup(opt_count("--warmup", optarg, 0, INT_MAX));
+	    break;
+	case OPT_SAMPLES: { /* Timed samples per trace: min[,max] */
+	    int min, max;
+	    if (sscanf(optarg, "%d,%d", &min, &max) == 1)
+		max = min;
+	    set_fsecs_samples(min, max);
+	    break;
+	}
+	case OPT_CI: /* Stop sampling once the 95% CI is within pct% */
+	    set_fsecs_ci(atof(optarg) / 100.0);
+	    break;
+	case OPT_CPU: /* Run on the nth CPU we may use */
+	    pin_cpu(opt_count("--cpu", optarg, 0, INT_MAX));
+	    break;
+	case OPT_TIMELINE: /* Write the footprint every nth op as CSV */
+	case OPT_TIMELINE_BIN: /* ... or in binary */
+	    timeline_every = opt_count("--timeline", optarg, 1, INT_MAX);
+	    timeline_bin = c == OPT_TIMELINE_BIN;
+	    break;
+	case OPT_TOUCH: /* Also run each trace touching n bytes per block */
+	    touch_bytes = opt_count("--touch", optarg, 0, SIZE_MAX);
+	    break;
+	case OPT_TOUCH_EVERY: /* ... and walking the live blocks every n ops */
+	    touch_every = opt_count("--touch-every", optarg, 0, INT_MAX);
+	    break;
+	case OPT_GENERATE: /* Stream a synthetic trace through mm */
+	    gen_spec = optarg;
+	    break;
+	case OPT_SWEEP: /* Time the --generate model at growing sizes */
+	    sweep_range = optarg;
+	    break;
+	case OPT_CONCURRENT: /* Replay each trace thread on a thread of its own */
+	    run_concurrent = 1;
+	    break;
+	case OPT_ANALYZE: /* Profile the -F or --generate trace, not replay it */
+	    run_analyze = 1;
+	    break;
+	case 'B': /* Compare latency with the background thread on and off */
+	    run_background = 1;
+	    break;
+	case 'C': /* Count hardware events per op */
+	    run_counters = 1;
+	    break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -176,6 +725,12 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+        case 'F': /* Stream one trace through mm, from stdin if "-" */
+            stream_file = optarg;
+            break;
+        case 'j': /* Evaluate up to n traces at once in worker processes */
+            jobs = opt_count("-j", optarg, 1, INT_MAX);
+            break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -186,6 +741,28 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Break down per-op latency by op type and size */
+            run_latency = 1;
+            break;
+        case 'R': /* Reserve n prefaulted bytes before each timed run */
+            reserve_bytes = opt_count("-R", optarg, 0, SIZE_MAX);
+            break;
+        case 'T': /* Trim the heap at each trace's live peak */
+            run_trim = 1;
+            break;
+        case 'M': /* Leave only n more bytes of address space to mm */
+            as_headroom = opt_count("-M", optarg, 0, SIZE_MAX);
+            break;
+        case 'P': /* Run the heap profiler, sampling every n bytes */
+            prof_rate = opt_count("-P", optarg, 0, SIZE_MAX);
+            break;
+        case 'S': /* Snapshot the heap after op n, or at its peak size */
+            snap_op = strcmp(optarg, "peak") == 0 ? SNAP_PEAK
+		: (int)opt_count("-S", optarg, 0, INT_MAX);
+            break;
+        case 'X': /* Run the false-sharing benchmark with n threads */
+            xthreads = opt_count("-X", optarg, 0, INT_MAX);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -201,6 +778,28 @@ int main(int argc, char **argv)
         }
     }
 	
+    /* --analyze reads a streamed or generated trace and replays nothing */
+    if (run_analyze
+	&& ((stream_file == NULL && gen_spec == NULL) || sweep_range != NULL)) {
+	fprintf(stderr, "--analyze needs -F or --generate, and no --sweep\n");
+	usage();
+	exit(1);
+    }
+
+    /* A sweep replays a generated trace through mm at growing sizes */
+    if (sweep_range != NULL) {
+	mem_init();
+	exit(eval_mm_sweep(sweep_range, gen_spec) ? 0 : 1);
+    }
+
+    /* Streaming replays, or analyzes, one trace and nothing else */
+    if (run_analyze)
+	exit(eval_analyze(stream_file, gen_spec) ? 0 : 1);
+    if (stream_file != NULL || gen_spec != NULL) {
+	mem_init();
+	exit(eval_mm_stream(stream_file, gen_spec) ? 0 : 1);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -214,6 +813,29 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Calibrate the counter that per-op latency is timed with */
+    if (run_latency || run_background || touch_bytes || run_concurrent
+	|| reserve_bytes) {
+	cyc_ovhd = cycles_ovhd();
+	cyc_per_ns = cycles_per_nsec();
+    }
+
+    /* A concurrent replay runs each trace on its threads and nothing else */
+    if (run_concurrent) {
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (!eval_concurrent(trace, tracefiles[i], 0)
+		|| (run_libc && !eval_concurrent(trace, tracefiles[i], 1)))
+		errors++;
+	    free_trace(trace);
+	}
+	exit(errors ? 1 : 0);
+    }
+
+    /* Traces read for the libc pass are kept for the mm pass */
+    if ((traces = (trace_t **)calloc(num_tracefiles, sizeof(trace_t *))) == NULL)
+	unix_error("traces calloc in main failed");
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -227,20 +849,14 @@ int main(int argc, char **argv)
 	    unix_error("libc_stats calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+	if (jobs > 1)
+	    run_parallel(eval_libc_trace, jobs, tracefiles, num_tracefiles,
+			 libc_stats);
+	else
+	    for (i=0; i < num_tracefiles; i++) {
+		trace = traces[i] = read_trace(tracedir, tracefiles[i]);
+		eval_libc_trace(trace, i, &libc_stats[i]);
 	    }
-	    free_trace(trace);
-	}
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
@@ -263,25 +879,27 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i].inst_util);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    /*
+     * Evaluate student's mm malloc package using the K-best scheme.
+     * Under -M each trace gets its own address-space cap, measured once
+     * the trace is read so that only mm's share is left; workers under
+     * -j set theirs the same way.
+     */
+    if (jobs > 1)
+	run_parallel(eval_mm_trace, jobs, tracefiles, num_tracefiles, mm_stats);
+    else
+	for (i=0; i < num_tracefiles; i++) {
+	    if (as_headroom)
+		limit_address_space(0);
+	    if ((trace = traces[i]) == NULL)
+		trace = read_trace(tracedir, tracefiles[i]);
+	    if (as_headroom)
+		limit_address_space(as_headroom);
+	    eval_mm_trace(trace, i, &mm_stats[i]);
+	    free_trace(trace);
 	}
-	free_trace(trace);
-    }
+    if (as_headroom)
+	limit_address_space(0);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -290,6 +908,144 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display how the timed samples of each trace were spread */
+    if (verbose) {
+	if (run_libc) {
+	    printf("Timed samples for libc malloc, msecs per run (%s):\n",
+		   fsecs_timer());
+	    printtiming(num_tracefiles, libc_stats);
+	    printf("\n");
+	}
+	printf("Timed samples for mm malloc, msecs per run (%s):\n",
+	       fsecs_timer());
+	printtiming(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the page faults taken by the timed runs */
+    if (verbose) {
+	printf("Page faults per timed run%s:\n",
+	       reserve_bytes ? " (after mm_reserve, which is not timed)" : "");
+	printfaults(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display mm's space use beside libc's */
+    if (verbose && run_libc) {
+	printf("Space, mm | libc malloc:\n");
+	printspace(num_tracefiles, libc_stats, mm_stats);
+	printf("\n");
+    }
+
+    /* Display how each trace's peak footprint breaks down */
+    if (verbose) {
+	printf("Footprint at peak heap size, %% of heap:\n");
+	printfootprint(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the footprint each trace sustained, not just its peak */
+    if (verbose) {
+	printf("Footprint over time, each op one unit:\n");
+	printsustained(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the footprint around each mm_trim call */
+    if (run_trim) {
+	printf("Footprint around mm_trim(0) at the live peak:\n");
+	printtrim(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display how mm coped with the address-space limit */
+    if (as_headroom) {
+	printf("Under an address-space limit of %lu more bytes:\n", as_headroom);
+	printlimit(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display per-op latency with and without the background thread */
+    if (run_background) {
+	printf("Per-op latency in nsecs and peak heap in bytes, "
+	       "background thread off | on:\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display how long the traces took when the blocks get used */
+    if (touch_bytes) {
+	printf("Memory-touch workload, %lu bytes per block", touch_bytes);
+	if (touch_every)
+	    printf(", all live blocks every %d ops", touch_every);
+	printf(", msecs per run:\n");
+	if (run_libc) {
+	    printf("libc malloc:\n");
+	    printtouch(num_tracefiles, libc_stats);
+	    printf("mm malloc:\n");
+	}
+	printtouch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display per-op latency by op type and request size */
+    if (run_latency) {
+	if (run_libc) {
+	    printf("Per-op latency in nsecs for libc malloc:\n");
+	    printoplatency(num_tracefiles, libc_stats);
+	    printf("\n");
+	}
+	printf("Per-op latency in nsecs for mm malloc:\n");
+	printoplatency(num_tracefiles, mm_stats);
+	printf("(timer overhead of %.0f nsecs taken off each op)\n\n",
+	       cyc_ovhd / cyc_per_ns);
+    }
+
+    /* Display hardware events per op; the counters were opened by
+       whichever process timed the traces, so this only reports why */
+    if (run_counters) {
+	if (perfctr_open() == 0)
+	    printf("Hardware counters unavailable (%s); -C needs a PMU and "
+		   "perf_event_paranoid <= 2\n\n", perfctr_error());
+	else {
+	    if (run_libc) {
+		printf("Hardware events per op for libc malloc%s:\n",
+		       perfctr_user_only() ? ", user mode only" : "");
+		printcounters(num_tracefiles, libc_stats);
+		printf("\n");
+	    }
+	    printf("Hardware events per op for mm malloc%s:\n",
+		   perfctr_user_only() ? ", user mode only" : "");
+	    printcounters(num_tracefiles, mm_stats);
+	    printf("\n");
+	}
+    }
+
+    /* Display the cost of the heap profiler */
+    if (prof_rate) {
+	printf("Heap profiler overhead, 1 sample per %lu bytes:\n", prof_rate);
+	printprof(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Measure cache-line placement against packed placement */
+    if (xthreads > 0) {
+	xresult_t packed, lines;
+
+	eval_false_sharing(xthreads, 0, &packed);
+	eval_false_sharing(xthreads, 1, &lines);
+	printf("False sharing, %d threads x %d blocks of %d bytes:\n",
+	       xthreads, XBLOCKS, XSIZE);
+	printf("%9s%11s%7s%8s\n", "placement", "Mwrites/s", "util", "shared");
+	printf("%9s%11.1f%6.0f%%%8d\n", "packed",
+	       packed.mwrites, packed.util*100.0, packed.shared);
+	printf("%9s%11.1f%6.0f%%%8d\n", "lines",
+	       lines.mwrites, lines.util*100.0, lines.shared);
+	printf("Throughput %+.1f%%, utilization %+.1f points\n\n",
+	       (lines.mwrites/packed.mwrites - 1.0)*100.0,
+	       (lines.util - packed.util)*100.0);
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -343,27 +1099,118 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Write the results for other tools, and hold them to a baseline */
+    if (json_file != NULL)
+	write_results(json_file, 0, tracefiles, num_tracefiles,
+		      libc_stats, mm_stats, perfindex);
+    if (csv_file != NULL)
+	write_results(csv_file, 1, tracefiles, num_tracefiles,
+		      libc_stats, mm_stats, perfindex);
+    if (baseline_file != NULL
+	&& check_baseline(baseline_file, tracefiles, num_tracefiles, mm_stats) > 0)
+	exit(1);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Records come
+ * from a pool that grows RANGE_SLAB records at a time.
  ****************************************************************/
 
+static range_t *range_pool = NULL;      /* unused range records */
+static unsigned range_seed = 2463534242u;
+
+/*
+ * new_range - Take a record from the pool, refilling it if empty
+ */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_SLAB * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in new_range");
+	for (i = 0; i < RANGE_SLAB; i++) {
+	    p[i].right = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->right;
+
+    /* xorshift32 */
+    range_seed ^= range_seed << 13;
+    range_seed ^= range_seed >> 17;
+    range_seed ^= range_seed << 5;
+    p->prio = range_seed;
+    p->left = p->right = NULL;
+    return p;
+}
+
+/*
+ * insert_range - Add record p to the treap rooted at t, returning the
+ *     new root
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    range_t *q;
+
+    if (t == NULL)
+	return p;
+    if (p->lo < t->lo) {
+	t->left = insert_range(t->left, p);
+	if (t->left->prio > t->prio) {  /* rotate right */
+	    q = t->left;
+	    t->left = q->right;
+	    q->right = t;
+	    t = q;
+	}
+    }
+    else {
+	t->right = insert_range(t->right, p);
+	if (t->right->prio > t->prio) { /* rotate left */
+	    q = t->right;
+	    t->right = q->left;
+	    q->left = t;
+	    t = q;
+	}
+    }
+    return t;
+}
+
+/*
+ * merge_ranges - Join treaps a and b, where all of a lies below b
+ */
+static range_t *merge_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL)
+	return b;
+    if (b == NULL)
+	return a;
+    if (a->prio > b->prio) {
+	a->right = merge_ranges(a->right, b);
+	return a;
+    }
+    b->left = merge_ranges(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, long opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *t;
     char msg[MAXLINE];
     size_t page_size = mem_pagesize(), i;
 
@@ -393,27 +1240,35 @@ static int add_range(range_t **ranges, char *lo, int size,
       return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Those don't
+     * overlap each other, so the one starting last at or below hi
+     * also ends last; if it ends below lo, so does every other. This
+     * catches a payload that encloses another, too.
+     */
+    for (p = NULL, t = *ranges;  t != NULL; ) {
+	if (t->lo <= hi) {
+	    p = t;
+	    t = t->right;
+	}
+	else
+	    t = t->left;
+    }
+    if (p != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -423,134 +1278,1950 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+	ranges = lo < p->lo ? &p->left : &p->right;
+    if (p != NULL) {
+	*ranges = merge_ranges(p->left, p->right);
+	p->right = range_pool;
+	range_pool = p;
     }
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the pool
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->right = range_pool;
+    range_pool = p;
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/*****************************************************************
+ * The following routines evaluate one trace, either in mdriver
+ * itself or, with -j, in a worker process of its own. Workers run
+ * on CPUs of their own and keep mm's and memlib's globals to
+ * themselves. Each holds a read lock on timing_fd while it works and
+ * trades it for the write lock while it times, so a worker times
+ * with no other worker running; the kernel drops either lock if its
+ * holder dies.
+ ****************************************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * timing_lock - Take the lock on timing_fd as type: F_RDLCK to work,
+ *     F_WRLCK to time, F_UNLCK to drop it
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void timing_lock(short type)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    struct flock fl;
 
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+    if (timing_fd < 0)
+	return;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_len = 1;
+    while (fcntl(timing_fd, F_SETLKW, &fl) < 0)
+	if (errno != EINTR)
+	    unix_error("fcntl failed in timing_lock");
+}
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+/*
+ * timing_begin - Wait until no other worker is running at all. The
+ *     read lock goes first, so that two workers waiting to time never
+ *     each hold what the other waits for.
+ */
+static void timing_begin(void)
+{
+    timing_lock(F_UNLCK);
+    timing_lock(F_WRLCK);
+}
+
+/*
+ * timing_end - Go back to working alongside the other workers
+ */
+static void timing_end(void)
+{
+    timing_lock(F_RDLCK);
+}
+
+/*
+ * time_speed - Time f with the sampling harness in fsecs.c and store
+ *     the median and spread of its samples in stats
+ */
+static void time_speed(fsecs_test_funct f, speed_t *params, stats_t *stats)
+{
+    fsecs_stats_t st;
+
+    stats->secs = fsecs_stats(f, params, &st);
+    stats->secs_min = st.min;
+    stats->secs_sd = st.stddev;
+    stats->noise = st.ci / st.mean;
+    stats->samples = st.samples;
+}
+
+/*
+ * time_touch - Time f, one of the touch workloads, and split the time
+ *     between the allocator and the touching
+ */
+static void time_touch(fsecs_test_funct f, trace_t *trace, stats_t *stats)
+{
+    speed_t params;
+    fsecs_stats_t st;
+
+    memset(&params, 0, sizeof(params));
+    params.trace = trace;
+    stats->touch_secs = fsecs_stats(f, &params, &st);
+    stats->touch_part = params.touch_ticks / (cyc_per_ns * 1e9) / params.touch_runs;
+}
+
+/*
+ * count_events - Run f once more with the hardware counters on and
+ *     store the events it took per op. The counters are opened on first
+ *     use, so that each -j worker counts itself.
+ */
+static void count_events(fsecs_test_funct f, speed_t *params, stats_t *stats)
+{
+    int i;
+
+    perfctr_open();
+    perfctr_start();
+    f(params);
+    perfctr_stop(stats->ctr);
+    for (i = 0; i < PC_EVENTS; i++)
+	if (stats->ctr[i] >= 0)
+	    stats->ctr[i] /= stats->ops;
+}
+
+/*
+ * eval_libc_trace - Check libc malloc on one trace, measure its
+ *     utilization and time it
+ */
+static void eval_libc_trace(trace_t *trace, int tracenum, stats_t *stats)
+{
+    speed_t speed_params;
+
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking libc malloc for correctness, ");
+    stats->valid = eval_libc_valid(trace, tracenum);
+    if (stats->valid) {
+	eval_libc_util(trace, stats);
+	speed_params.trace = trace;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	timing_begin();
+	time_speed(eval_libc_speed, &speed_params, stats);
+	if (touch_bytes)
+	    time_touch(eval_libc_touch, trace, stats);
+	if (run_counters)
+	    count_events(eval_libc_speed, &speed_params, stats);
+	if (run_latency)
+	    eval_latency(trace, 1, 0, &stats->alllat, stats->oplat);
+	timing_end();
+    }
+}
+
+/*
+ * eval_mm_trace - Check mm on one trace, measure its utilization and
+ *     time it, along with whatever extras the command line asked for
+ */
+static void eval_mm_trace(trace_t *trace, int tracenum, stats_t *stats)
+{
+    range_t *ranges = NULL;  /* keeps track of block extents */
+    speed_t speed_params;
+    fsecs_stats_t st;
+
+    stats->ops = trace->num_ops;
+    mem_resetpeak();
+    mm_set_reclaim(count_reclaim, &stats->reclaims);
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (!stats->valid)
+	mem_reset(); /* don't leave the failed run's pages to the next trace */
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, &ranges, stats);
+	if (run_trim)
+	    eval_mm_trim(trace, stats);
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	speed_params.minflt = speed_params.majflt = 0;
+	speed_params.reserve_ticks = 0;
+	speed_params.runs = 0;
+	speed_params.failed_op = -1;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	timing_begin();
+	time_speed(eval_mm_speed, &speed_params, stats);
+	if (speed_params.failed_op >= 0) {
+	    /* Only reachable under -M: the timed runs don't check
+	       blocks, so they can't reuse a heap the way the util
+	       pass does, and may run out first */
+	    malloc_error(tracenum, speed_params.failed_op,
+			 "mm_malloc failed in a timed run.");
+	    stats->valid = 0;
+	    timing_end();
+	    stats->peak_heap = mem_peakheapsize();
+	    clear_ranges(&ranges);
+	    return;
+	}
+	stats->minflt = (double)speed_params.minflt / speed_params.runs;
+	stats->majflt = (double)speed_params.majflt / speed_params.runs;
+
+	/* Each timed run starts with mm_reserve; take it back out, so
+	   that the throughput matches the faults counted after it */
+	stats->reserve_secs = speed_params.reserve_ticks / (cyc_per_ns * 1e9)
+	    / speed_params.runs;
+	stats->secs -= stats->reserve_secs;
+	stats->secs_min -= stats->reserve_secs;
+	if (run_counters)
+	    count_events(eval_mm_speed, &speed_params, stats);
+	if (touch_bytes)
+	    time_touch(eval_mm_touch, trace, stats);
+	if (prof_rate) {
+	    if (mm_profile_start(prof_rate) < 0)
+		unix_error("mm_profile_start failed in eval_mm_trace");
+	    stats->prof_secs = fsecs_stats(eval_mm_speed, &speed_params, &st);
+	    mm_profile_stop();
+	}
+	if (run_background) {
+	    eval_latency(trace, 0, 0, &stats->lat[0], NULL);
+	    eval_latency(trace, 0, 1, &stats->lat[1], NULL);
+	}
+	if (run_latency)
+	    eval_latency(trace, 0, 0, &stats->alllat, stats->oplat);
+	timing_end();
+    }
+    stats->peak_heap = mem_peakheapsize();
+    clear_ranges(&ranges);
+}
+
+/*
+ * pin_cpu - Pin the calling process to the slot'th CPU it may run on
+ */
+static void pin_cpu(int slot)
+{
+    cpu_set_t allowed, one;
+    int cpu, n = 0, target;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	return;
+    target = slot % CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+	if (!CPU_ISSET(cpu, &allowed) || n++ != target)
+	    continue;
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	sched_setaffinity(0, sizeof(one), &one);
+	return;
+    }
+}
+
+/*
+ * run_parallel - Evaluate the n traces with fn, in up to njobs worker
+ *     processes at once, and collect their stats. A worker that dies
+ *     counts as an error and leaves its trace marked invalid. There are
+ *     never more workers than CPUs to run them on.
+ */
+static void run_parallel(trace_fn fn, int njobs, char **tracefiles, int n,
+			 stats_t *stats)
+{
+    int results[2];
+    FILE *lockfile;
+    pid_t pid, *slots;
+    result_t res;
+    cpu_set_t allowed;
+    int next = 0, running = 0, slot, status;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0
+	&& njobs > CPU_COUNT(&allowed))
+	njobs = CPU_COUNT(&allowed);
+    if (pipe(results) < 0)
+	unix_error("pipe failed in run_parallel");
+    if ((lockfile = tmpfile()) == NULL)
+	unix_error("tmpfile failed in run_parallel");
+    timing_fd = fileno(lockfile);
+    if ((slots = (pid_t *)calloc(njobs, sizeof(pid_t))) == NULL)
+	unix_error("calloc failed in run_parallel");
+
+    while (next < n || running > 0) {
+	/* Start a worker for the next trace in a free slot */
+	if (next < n && running < njobs) {
+	    for (slot = 0; slots[slot] != 0; slot++)
+		;
+	    fflush(stdout);
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in run_parallel");
+	    if (pid == 0) {
+		trace_t *trace;
+
+		close(results[0]);
+		pin_cpu(slot);
+		timing_lock(F_RDLCK);
+		errors = 0; /* count only this worker's */
+		trace = read_trace(tracedir, tracefiles[next]);
+		if (as_headroom && fn == eval_mm_trace)
+		    limit_address_space(as_headroom);
+		memset(&res, 0, sizeof(res));
+		res.tracenum = next;
+		fn(trace, next, &res.stats);
+		res.errors = errors;
+		fflush(stdout);
+		/* Writes of up to PIPE_BUF bytes don't interleave */
+		if (write(results[1], &res, sizeof(res)) != sizeof(res))
+		    _exit(1);
+		_exit(0);
+	    }
+	    slots[slot] = pid;
+	    running++;
+	    next++;
+	    continue;
+	}
+
+	/* Collect a finished worker; its result is already in the pipe */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in run_parallel");
+	for (slot = 0; slot < njobs && slots[slot] != pid; slot++)
+	    ;
+	if (slot == njobs)
+	    continue;
+	slots[slot] = 0;
+	running--;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+	    if (read(results[0], &res, sizeof(res)) != sizeof(res))
+		unix_error("read of worker result failed");
+	    stats[res.tracenum] = res.stats;
+	    errors += res.errors;
+	}
+	else {
+	    errors++;
+	    printf("ERROR: worker process %d ", (int)pid);
+	    if (WIFSIGNALED(status))
+		printf("was killed by signal %d\n", WTERMSIG(status));
+	    else
+		printf("exited with status %d\n", WEXITSTATUS(status));
+	}
+    }
+
+    close(results[0]);
+    close(results[1]);
+    fclose(lockfile);
+    timing_fd = -1;
+    free(slots);
+}
+
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * alloc_trace - allocate the arrays of a trace whose header has been read
+ */
+static void alloc_trace(trace_t *trace)
+{
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)calloc(trace->num_ops, sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+    trace->num_threads = 1;
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * get_varint - decode the varint at *pp, which must end before end,
+ *     and advance *pp past it. Returns 0 if it runs past end.
+ */
+static int get_varint(unsigned char **pp, unsigned char *end, uint64_t *val)
+{
+    unsigned char *p = *pp;
+    uint64_t v = 0;
+    int shift = 0;
+
+    do {
+	if (p == end || shift > 63)
+	    return 0;
+	v |= (uint64_t)(*p & 0x7f) << shift;
+	shift += 7;
+    } while (*p++ & 0x80);
+    *pp = p;
+    *val = v;
+    return 1;
+}
+
+/*
+ * read_bin_trace - map the binary trace file open on fd (see
+ *     traces/rep2bin.pl for the layout) and decode its op records
+ *     straight out of the mapping
+ */
+static void read_bin_trace(trace_t *trace, int fd, char *path)
+{
+    struct stat st;
+    bin_header_t *hdr;
+    unsigned char *map, *p, *end;
+    uint64_t index, size;
+    int type, op_index;
+
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_bin_trace");
+    if (st.st_size < sizeof(bin_header_t)) {
+	sprintf(msg, "%s is too short for a binary trace", path);
+	app_error(msg);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	unix_error("mmap failed in read_bin_trace");
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    hdr = (bin_header_t *)map;
+    if (hdr->num_ids > INT_MAX || hdr->num_ops > INT_MAX
+	|| hdr->data_bytes != st.st_size - sizeof(bin_header_t)) {
+	sprintf(msg, "Bad header in binary trace %s", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;  /* not used */
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;                /* not used */
+    alloc_trace(trace);
+
+    p = map + sizeof(bin_header_t);
+    end = map + st.st_size;
+    for (op_index = 0; op_index < trace->num_ops; op_index++) {
+	if (p == end)
+	    break;
+	type = *p++;
+	if (!get_varint(&p, end, &index) || index >= trace->num_ids)
+	    break;
+	trace->ops[op_index].index = index;
+	if (type == 'f') {
+	    trace->ops[op_index].type = FREE;
+	    continue;
+	}
+	if ((type != 'a' && type != 'r')
+	    || !get_varint(&p, end, &size) || size > INT_MAX)
+	    break;
+	trace->ops[op_index].type = (type == 'a') ? ALLOC : REALLOC;
+	trace->ops[op_index].size = size;
+    }
+    if (op_index < trace->num_ops || p != end) {
+	sprintf(msg, "Bad op record %d in binary trace %s", op_index, path);
+	app_error(msg);
+    }
+    munmap(map, st.st_size);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. Binary trace
+ *     files are recognized by their magic number.
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char type[MAXLINE];
+    char path[MAXLINE];
+    char magic[sizeof(BIN_MAGIC)-1];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+    int thread;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+	
+    /* Read the trace file header */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fread(magic, sizeof(magic), 1, tracefile) == 1
+	&& memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0) {
+	read_bin_trace(trace, fileno(tracefile), path);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    alloc_trace(trace);
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	/* A request may start with the number of the thread that made it */
+	if (type[0] >= '0' && type[0] <= '9') {
+	    thread = atoi(type);
+	    if (thread >= MAX_THREADS || fscanf(tracefile, "%s", type) != 1) {
+		printf("Bad thread column (%s) in tracefile %s\n", type, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].thread = thread;
+	    if (thread >= trace->num_threads)
+		trace->num_threads = thread + 1;
+	}
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+	
+    }
+    fclose(tracefile);
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    free(trace->ops);         /* free the three arrays... */
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*****************************************************************
+ * The following routines generate a synthetic trace from a model
+ * as it is replayed, so workloads of millions of ops need no trace
+ * file. Block sizes come from one of a few distributions. Whether
+ * the next op allocates or frees is steered toward a live-set target,
+ * and the block that is freed is the live one that is due first
+ * under the lifetime model.
+ ****************************************************************/
+
+/*
+ * gen_rand - The next number from the generator's xorshift64*
+ */
+static uint64_t gen_rand(gen_t *g)
+{
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * gen_uniform - A uniform double in (0, 1]
+ */
+static double gen_uniform(gen_t *g)
+{
+    return ((gen_rand(g) >> 11) + 1) * 0x1.0p-53;
+}
+
+/*
+ * gen_size - Draw a request size from the model's size distribution
+ */
+static uint64_t gen_size(gen_t *g)
+{
+    double *a = g->size_arg, u, z, size;
+    uint64_t lo, hi;
+    int k;
+
+    switch (g->size_dist) {
+    case GEN_UNIFORM:
+	lo = (uint64_t)a[0];
+	hi = (uint64_t)a[1];
+	return lo + gen_rand(g) % (hi - lo + 1);
+    case GEN_LOGNORMAL: /* Box-Muller for the normal */
+	z = sqrt(-2 * log(gen_uniform(g))) * cos(2 * M_PI * gen_uniform(g));
+	size = a[0] * exp(a[1] * z);
+	return size < 1 ? 1 : (uint64_t)size;
+    case GEN_ZIPF: /* class k holds sizes in (8 << k, 16 << k] */
+	u = gen_uniform(g);
+	for (k = 0; k < (int)a[1] - 1 && g->zipf_cdf[k] < u; k++)
+	    ;
+	lo = k ? (uint64_t)8 << k : 0;
+	hi = (uint64_t)16 << k;
+	return lo + 1 + gen_rand(g) % (hi - lo);
+    default: /* GEN_BIMODAL */
+	return (uint64_t)(gen_uniform(g) <= a[2] ? a[1] : a[0]);
+    }
+}
+
+/*
+ * gen_push, gen_pop - Add a block to, and take the soonest due block
+ *     off, the generator's heap of live blocks
+ */
+static void gen_push(gen_t *g, genblock_t b)
+{
+    size_t i, parent;
+
+    if (g->count == g->max) {
+	g->max = g->max ? g->max * 2 : IDMAP_MIN;
+	if ((g->heap = realloc(g->heap, g->max * sizeof(genblock_t))) == NULL)
+	    unix_error("realloc failed in gen_push");
+    }
+    for (i = g->count++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (g->heap[parent].due <= b.due)
+	    break;
+	g->heap[i] = g->heap[parent];
+    }
+    g->heap[i] = b;
+}
+
+static genblock_t gen_pop(gen_t *g)
+{
+    genblock_t top = g->heap[0], last = g->heap[--g->count];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < g->count) {
+	if (child + 1 < g->count && g->heap[child + 1].due < g->heap[child].due)
+	    child++;
+	if (last.due <= g->heap[child].due)
+	    break;
+	g->heap[i] = g->heap[child];
+	i = child;
+    }
+    g->heap[i] = last;
+    return top;
+}
+
+/*
+ * gen_op - Generate the next op
+ *     Returns 1, or 0 once the ops are done and every block is freed
+ */
+static int gen_op(gen_t *g, streamop_t *op)
+{
+    genblock_t b;
+    double p_alloc;
+
+    if (g->now < g->ops) {
+	g->now++;
+
+	/* Allocate for certain when empty, and never at twice the target */
+	p_alloc = 1 - 0.5 * g->live / g->live_target;
+	if (g->count == 0 || g->heap[0].due == HUGE_VAL
+	    || gen_uniform(g) <= p_alloc) {
+	    b.id = g->next_id++;
+	    b.size = gen_size(g);
+	    if (gen_uniform(g) <= g->long_lived)
+		b.due = HUGE_VAL;
+	    else if (g->life == GEN_EXP)
+		b.due = g->now - g->mean_life * log(gen_uniform(g));
+	    else
+		b.due = g->life == GEN_FIFO ? (double)g->now : -(double)g->now;
+	    gen_push(g, b);
+	    g->live += b.size;
+	    op->type = ALLOC;
+	    op->id = b.id;
+	    op->size = b.size;
+	    return 1;
+	}
+    }
+    else if (g->count == 0)
+	return 0;
+
+    b = gen_pop(g);
+    g->live -= b.size;
+    op->type = FREE;
+    op->id = b.id;
+    op->size = 0;
+    return 1;
+}
+
+/*
+ * gen_scale - Restart the generator from its seed with a new op count
+ *     and live-set target
+ */
+static void gen_scale(gen_t *g, uint64_t ops, uint64_t live_target)
+{
+    g->ops = ops;
+    g->live_target = live_target;
+    g->rng = (g->seed + 1) * 0x9e3779b97f4a7c15ULL;
+    if (g->rng == 0)
+	g->rng = 1;
+    g->now = g->next_id = g->live = 0;
+    g->count = 0;
+
+    /*
+     * About half the ops allocate once the live set reaches its target,
+     * so by Little's law a block must live for twice as many ops as
+     * there are blocks in the target
+     */
+    if (g->mean_size > 0)
+	g->mean_life = 2 * live_target / g->mean_size;
+}
+
+/*
+ * gen_count - Parse a count with an optional K, M or G suffix, ending
+ *     at the end of val or a comma
+ *     Returns 0 if val isn't such a count
+ */
+static int gen_count(char *val, uint64_t *count)
+{
+    char *end;
+    double v = strtod(val, &end);
+
+    if (end == val || !(v >= 0))
+	return 0;
+    switch (*end) {
+    case 'k': case 'K': v *= 1 << 10; end++; break;
+    case 'm': case 'M': v *= 1 << 20; end++; break;
+    case 'g': case 'G': v *= 1 << 30; end++; break;
+    }
+    if ((*end != '\0' && *end != ',') || v >= 18446744073709551616.0)
+	return 0;
+    *count = (uint64_t)v;
+    return 1;
+}
+
+/*
+ * gen_fraction - Parse a number from 0 to 1
+ *     Returns 0 if val isn't one
+ */
+static int gen_fraction(char *val, double *frac)
+{
+    char *end;
+    double v = strtod(val, &end);
+
+    if (end == val || *end != '\0' || !(v >= 0 && v <= 1))
+	return 0;
+    *frac = v;
+    return 1;
+}
+
+/*
+ * new_generator - Build a trace model from a --generate spec, a comma
+ *     separated list of key=value settings:
+ *
+ *       ops=<n>         ops before the live blocks are freed (default 1M)
+ *       live=<bytes>    live payload to hover around (default 16M)
+ *       size=<dist>     uniform:lo:hi, lognormal:median:sigma,
+ *                       zipf:s:classes or bimodal:small:large:p
+ *                       (default lognormal:64:1)
+ *       life=<model>    exp, lifo or fifo (default exp)
+ *       long=<frac>     fraction of blocks that live to the end (default 0)
+ *       seed=<n>        (default 1)
+ *
+ *     Missing distribution parameters take the defaults uniform:1:4096,
+ *     lognormal:64:1, zipf:1:12 and bimodal:32:4096:0.1. Long-lived
+ *     blocks count toward the live set but are never freed early, so
+ *     they pile up past the target if there are enough of them.
+ */
+static gen_t *new_generator(char *spec)
+{
+    static const double size_defaults[4][3] = {
+	{1, 4096, 0}, {64, 1, 0}, {1, 12, 0}, {32, 4096, 0.1}
+    };
+    static const char *size_names[4] = {"uniform", "lognormal", "zipf", "bimodal"};
+    gen_t *g, tmp;
+    char *copy, *item, *val, *save, *rest, name[16];
+    double a[3], sum;
+    int i, n, end;
+
+    if ((g = (gen_t *)calloc(1, sizeof(gen_t))) == NULL
+	|| (copy = strdup(spec)) == NULL)
+	unix_error("malloc failed in new_generator");
+    g->ops = 1 << 20;
+    g->live_target = 16 << 20;
+    g->size_dist = GEN_LOGNORMAL;
+    memcpy(g->size_arg, size_defaults[GEN_LOGNORMAL], sizeof(g->size_arg));
+    g->life = GEN_EXP;
+    g->seed = 1;
+
+    for (item = strtok_r(copy, ",", &save); item != NULL;
+	 item = strtok_r(NULL, ",", &save)) {
+	if ((val = strchr(item, '=')) == NULL)
+	    goto bad;
+	*val++ = '\0';
+	if (strcmp(item, "ops") == 0) {
+	    if (!gen_count(val, &g->ops))
+		goto bad;
+	}
+	else if (strcmp(item, "live") == 0) {
+	    if (!gen_count(val, &g->live_target))
+		goto bad;
+	}
+	else if (strcmp(item, "long") == 0) {
+	    if (!gen_fraction(val, &g->long_lived))
+		goto bad;
+	}
+	else if (strcmp(item, "seed") == 0) {
+	    g->seed = strtoull(val, &rest, 0);
+	    if (rest == val || *rest != '\0' || *val == '-')
+		goto bad;
+	}
+	else if (strcmp(item, "life") == 0) {
+	    if (strcmp(val, "exp") == 0)
+		g->life = GEN_EXP;
+	    else if (strcmp(val, "lifo") == 0)
+		g->life = GEN_LIFO;
+	    else if (strcmp(val, "fifo") == 0)
+		g->life = GEN_FIFO;
+	    else
+		goto bad;
+	}
+	else if (strcmp(item, "size") == 0) {
+	    end = -1;
+	    n = sscanf(val, "%15[a-z]%n:%lf%n:%lf%n:%lf%n", name, &end, &a[0],
+		       &end, &a[1], &end, &a[2], &end);
+	    for (i = 0; i < 4 && (n < 1 || strcmp(name, size_names[i]) != 0); i++)
+		;
+	    if (i == 4 || end < 0 || val[end] != '\0')
+		goto bad;
+	    g->size_dist = i;
+	    memcpy(g->size_arg, size_defaults[i], sizeof(g->size_arg));
+	    memcpy(g->size_arg, a, (n - 1) * sizeof(double));
+	}
+	else
+	    goto bad;
+    }
+    free(copy);
+
+    a[0] = g->size_arg[0];
+    a[1] = g->size_arg[1];
+    a[2] = g->size_arg[2];
+    if (g->live_target == 0
+	|| (g->size_dist == GEN_UNIFORM && (a[0] < 1 || a[1] < a[0]))
+	|| (g->size_dist == GEN_LOGNORMAL && (a[0] <= 0 || a[1] < 0))
+	|| (g->size_dist == GEN_ZIPF && (a[1] < 1 || a[1] > GEN_CLASSES))
+	|| (g->size_dist == GEN_BIMODAL
+	    && (a[0] < 1 || a[1] < 1 || !(a[2] >= 0 && a[2] <= 1))))
+	goto bad_spec;
+
+    if (g->size_dist == GEN_ZIPF) {
+	for (i = 0, sum = 0; i < (int)a[1]; i++)
+	    g->zipf_cdf[i] = sum += pow(i + 1, -a[0]);
+	for (i = 0; i < (int)a[1]; i++)
+	    g->zipf_cdf[i] /= sum;
+    }
+
+    /* The mean size is taken from draws on a copy of the generator */
+    gen_scale(g, g->ops, g->live_target);
+    tmp = *g;
+    for (i = 0; i < 4096; i++)
+	g->mean_size += gen_size(&tmp);
+    g->mean_size /= 4096;
+    gen_scale(g, g->ops, g->live_target);
+    return g;
+
+ bad:
+    free(copy);
+ bad_spec:
+    sprintf(msg, "Bad --generate spec %.900s", spec);
+    app_error(msg);
+    return NULL;
+}
+
+/*****************************************************************
+ * The following routines stream a trace through mm without
+ * holding it in memory. A parser thread reads ops in windows of
+ * STREAM_WINDOW into a ring that the replay loop drains, and live
+ * blocks are found through a hash table on id, so memory use follows
+ * the live set rather than the length of the trace.
+ ****************************************************************/
+
+/*
+ * idmap_find - Return the slot of id in map, or the empty slot where
+ *     it would go
+ */
+static idslot_t *idmap_find(idmap_t *map, uint64_t id)
+{
+    size_t i = (id * 0x9e3779b97f4a7c15ULL) >> 16 & map->mask;
+
+    while (map->slots[i].p != NULL && map->slots[i].id != id)
+	i = (i + 1) & map->mask;
+    return &map->slots[i];
+}
+
+/*
+ * idmap_resize - Rehash map into nslots slots
+ */
+static void idmap_resize(idmap_t *map, size_t nslots)
+{
+    idslot_t *old = map->slots;
+    size_t i, oldn = old ? map->mask + 1 : 0;
+
+    if ((map->slots = (idslot_t *)calloc(nslots, sizeof(idslot_t))) == NULL)
+	unix_error("calloc failed in idmap_resize");
+    map->mask = nslots - 1;
+    for (i = 0; i < oldn; i++)
+	if (old[i].p != NULL)
+	    *idmap_find(map, old[i].id) = old[i];
+    free(old);
+}
+
+/*
+ * idmap_put - Fill the empty slot returned by idmap_find
+ */
+static void idmap_put(idmap_t *map, idslot_t *slot, uint64_t id,
+		      char *p, uint64_t size)
+{
+    slot->id = id;
+    slot->p = p;
+    slot->size = size;
+    if (++map->count * 2 > map->mask + 1)
+	idmap_resize(map, (map->mask + 1) * 2);
+}
+
+/*
+ * idmap_remove - Empty a slot, moving later entries of its probe run
+ *     back so that lookups still find them
+ */
+static void idmap_remove(idmap_t *map, idslot_t *slot)
+{
+    size_t i = slot - map->slots, j = i, home;
+
+    for (;;) {
+	map->slots[i].p = NULL;
+	for (;;) {
+	    j = (j + 1) & map->mask;
+	    if (map->slots[j].p == NULL) {
+		map->count--;
+		if (map->count * 8 < map->mask + 1 && map->mask + 1 > IDMAP_MIN)
+		    idmap_resize(map, (map->mask + 1) / 2);
+		return;
+	    }
+	    home = (map->slots[j].id * 0x9e3779b97f4a7c15ULL) >> 16 & map->mask;
+	    /* Move j back to i unless its home lies cyclically in (i, j] */
+	    if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+		break;
+	}
+	map->slots[i] = map->slots[j];
+	i = j;
+    }
+}
+
+/*
+ * get_number - Read an unsigned decimal number from a text trace
+ *     Returns 0 if there isn't one
+ */
+static int get_number(FILE *in, uint64_t *val)
+{
+    uint64_t v = 0;
+    int c;
+
+    while ((c = getc_unlocked(in)) == ' ' || c == '\t' || c == '\r'
+	   || c == '\n')
+	;
+    if (c < '0' || c > '9')
+	return 0;
+    do
+	v = v * 10 + (c - '0');
+    while ((c = getc_unlocked(in)) >= '0' && c <= '9');
+    ungetc(c, in);
+    *val = v;
+    return 1;
+}
+
+/*
+ * get_stream_varint - Read a varint from a binary trace
+ *     Returns 0 at the end of the input
+ */
+static int get_stream_varint(FILE *in, uint64_t *val)
+{
+    uint64_t v = 0;
+    int c, shift = 0;
+
+    do {
+	if ((c = getc_unlocked(in)) == EOF || shift > 63)
+	    return 0;
+	v |= (uint64_t)(c & 0x7f) << shift;
+	shift += 7;
+    } while (c & 0x80);
+    *val = v;
+    return 1;
+}
+
+/*
+ * get_stream_op - Read the next op of a streamed trace
+ *     Returns 1, 0 at the end of the trace, or -1 on bad input
+ */
+static int get_stream_op(stream_t *st, streamop_t *op)
+{
+    int c, ok;
+
+    if (st->gen != NULL)
+	return gen_op(st->gen, op);
+    if (st->binary)
+	c = getc_unlocked(st->in);
+    else {
+	while ((c = getc_unlocked(st->in)) == ' ' || c == '\t' || c == '\r'
+	       || c == '\n')
+	    ;
+	/* Streaming replays in file order, so a thread column is skipped */
+	if (c >= '0' && c <= '9') {
+	    ungetc(c, st->in);
+	    get_number(st->in, &op->id);
+	    while ((c = getc_unlocked(st->in)) == ' ' || c == '\t')
+		;
+	}
+    }
+    if (c == EOF)
+	return 0;
+
+    switch (c) {
+    case 'a':
+	op->type = ALLOC;
+	break;
+    case 'r':
+	op->type = REALLOC;
+	break;
+    case 'f':
+	op->type = FREE;
+	break;
+    default:
+	sprintf(st->error, "bad op type (%c) at op %" PRIu64, c, st->parsed);
+	return -1;
+    }
+
+    if (st->binary)
+	ok = get_stream_varint(st->in, &op->id)
+	    && (op->type == FREE || get_stream_varint(st->in, &op->size));
+    else
+	ok = get_number(st->in, &op->id)
+	    && (op->type == FREE || get_number(st->in, &op->size));
+    if (!ok) {
+	sprintf(st->error, "truncated op %" PRIu64, st->parsed);
+	return -1;
+    }
+    st->parsed++;
+    return 1;
+}
+
+/*
+ * stream_main - The parser thread: fill windows until the input ends
+ */
+static void *stream_main(void *arg)
+{
+    stream_t *st = (stream_t *)arg;
+    window_t *w;
+    int n, r = 1;
+
+    while (r > 0) {
+	pthread_mutex_lock(&st->lock);
+	while (st->filled - st->drained == STREAM_WINDOWS && !st->stop)
+	    pthread_cond_wait(&st->changed, &st->lock);
+	pthread_mutex_unlock(&st->lock);
+	if (st->stop)
+	    break;
+
+	w = &st->windows[st->filled % STREAM_WINDOWS];
+	for (n = 0; n < STREAM_WINDOW && !st->stop; n++)
+	    if ((r = get_stream_op(st, &w->ops[n])) <= 0)
+		break;
+	w->count = n;
+
+	pthread_mutex_lock(&st->lock);
+	st->filled++;
+	if (r <= 0)
+	    st->done = (r == 0) ? 1 : -1;
+	pthread_cond_signal(&st->changed);
+	pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+/*
+ * init_stream_ring - Set up the windows and lock shared by the parser
+ *     thread and the replay loop
+ */
+static void init_stream_ring(stream_t *st)
+{
+    if ((st->windows = (window_t *)malloc(STREAM_WINDOWS * sizeof(window_t)))
+	== NULL)
+	unix_error("malloc failed in init_stream_ring");
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->changed, NULL);
+}
+
+/*
+ * open_stream - Open a trace for streaming and read its header
+ */
+static void open_stream(stream_t *st, char *filename)
+{
+    bin_header_t hdr;
+    uint64_t ids, ops, skip;
+    int c;
+
+    memset(st, 0, sizeof(*st));
+    st->name = filename;
+    if (strcmp(filename, "-") == 0) {
+	st->in = stdin;
+	st->name = "stdin";
+    }
+    else if ((st->in = fopen(filename, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in open_stream", filename);
+	unix_error(msg);
+    }
+
+    /* Text headers start with a digit, binary ones with BIN_MAGIC */
+    if ((c = getc(st->in)) == BIN_MAGIC[0]) {
+	hdr.magic[0] = c;
+	if (fread(hdr.magic + 1, sizeof(hdr) - 1, 1, st->in) != 1
+	    || memcmp(hdr.magic, BIN_MAGIC, sizeof(hdr.magic)) != 0) {
+	    sprintf(msg, "Bad header in binary trace %s", st->name);
+	    app_error(msg);
+	}
+	st->binary = 1;
+	st->num_ids = hdr.num_ids;
+	st->num_ops = hdr.num_ops;
+    }
+    else {
+	ungetc(c, st->in);
+	if (!get_number(st->in, &skip) || !get_number(st->in, &ids)
+	    || !get_number(st->in, &ops) || !get_number(st->in, &skip)) {
+	    sprintf(msg, "Bad header in trace %s", st->name);
+	    app_error(msg);
+	}
+	st->num_ids = ids;
+	st->num_ops = ops;
+    }
+    init_stream_ring(st);
+}
+
+/*
+ * open_generated - Set up a stream whose ops come from a --generate
+ *     model rather than a file
+ */
+static void open_generated(stream_t *st, char *spec)
+{
+    memset(st, 0, sizeof(*st));
+    st->name = spec;
+    st->gen = new_generator(spec);
+    st->num_ops = st->gen->ops;
+    init_stream_ring(st);
+}
+
+/*
+ * next_window - Wait for the parser to hand over the next window, adding
+ *     the secs spent waiting to *waited
+ *     Returns NULL once the trace is used up
+ */
+static window_t *next_window(stream_t *st, double *waited)
+{
+    struct timespec wait0, wait1;
+    int more;
+
+    pthread_mutex_lock(&st->lock);
+    if (st->filled == st->drained && !st->done) {
+	clock_gettime(CLOCK_MONOTONIC, &wait0);
+	while (st->filled == st->drained && !st->done)
+	    pthread_cond_wait(&st->changed, &st->lock);
+	clock_gettime(CLOCK_MONOTONIC, &wait1);
+	*waited += (wait1.tv_sec - wait0.tv_sec)
+	    + 1e-9 * (wait1.tv_nsec - wait0.tv_nsec);
+    }
+    more = st->filled != st->drained;
+    pthread_mutex_unlock(&st->lock);
+    return more ? &st->windows[st->drained % STREAM_WINDOWS] : NULL;
+}
+
+/*
+ * drain_window - Hand the window from next_window back to the parser
+ */
+static void drain_window(stream_t *st)
+{
+    pthread_mutex_lock(&st->lock);
+    st->drained++;
+    pthread_cond_signal(&st->changed);
+    pthread_mutex_unlock(&st->lock);
+}
+
+/*
+ * eval_mm_stream - Replay the trace in filename (stdin if "-"), or the
+ *     one generated from spec if filename is NULL, through mm as it is
+ *     parsed, checking every payload as eval_mm_valid does and tracking
+ *     peak payload and heap size
+ */
+static int eval_mm_stream(char *filename, char *spec)
+{
+    stream_t st;
+    pthread_t parser;
+    idmap_t map = {NULL, 0, 0};
+    idslot_t *slot;
+    range_t *ranges = NULL;
+    window_t *w;
+    streamop_t *op;
+    char *p;
+    uint64_t i = 0, live = 0, max_live = 0, max_blocks = 0;
+    size_t size, heap, max_heap = 0;
+    struct timespec start, end;
+    double secs, waited = 0;
+    int k, ok = 1;
+
+    if (filename != NULL)
+	open_stream(&st, filename);
+    else
+	open_generated(&st, spec);
+    idmap_resize(&map, IDMAP_MIN);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stream");
+    if (pthread_create(&parser, NULL, stream_main, &st) != 0)
+	unix_error("pthread_create failed in eval_mm_stream");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (ok && (w = next_window(&st, &waited)) != NULL) {
+	for (k = 0; k < w->count && ok; k++, i++) {
+	    op = &w->ops[k];
+	    slot = idmap_find(&map, op->id);
+	    size = op->size ? op->size : 1; /* mm_malloc(0) may return NULL */
+
+	    switch (op->type) {
+	    case ALLOC:
+		if (slot->p != NULL) {
+		    malloc_error(0, i, "id allocated again before being freed");
+		    ok = 0;
+		    break;
+		}
+		if ((p = mm_malloc(size)) == NULL) {
+		    malloc_error(0, i, "mm_malloc failed.");
+		    ok = 0;
+		    break;
+		}
+		if (!add_range(&ranges, p, size, 0, i)) {
+		    ok = 0;
+		    break;
+		}
+		idmap_put(&map, slot, op->id, p, op->size);
+		live += op->size;
+		break;
+
+	    case REALLOC: /* mm_malloc + mm_free */
+		if (slot->p == NULL) {
+		    malloc_error(0, i, "realloc of an id that isn't allocated");
+		    ok = 0;
+		    break;
+		}
+		if ((p = mm_malloc(size)) == NULL) {
+		    malloc_error(0, i, "mm_malloc failed.");
+		    ok = 0;
+		    break;
+		}
+		remove_range(&ranges, slot->p);
+		if (!add_range(&ranges, p, size, 0, i)) {
+		    ok = 0;
+		    break;
+		}
+		mm_free(slot->p);
+		live += op->size - slot->size;
+		slot->p = p;
+		slot->size = op->size;
+		break;
+
+	    case FREE:
+		if (slot->p == NULL) {
+		    malloc_error(0, i, "free of an id that isn't allocated");
+		    ok = 0;
+		    break;
+		}
+		remove_range(&ranges, slot->p);
+		mm_free(slot->p);
+		live -= slot->size;
+		idmap_remove(&map, slot);
+		break;
+	    }
+
+	    if (live > max_live)
+		max_live = live;
+	    if (map.count > max_blocks)
+		max_blocks = map.count;
+	    if ((heap = mem_heapsize()) > max_heap)
+		max_heap = heap;
+	}
+	drain_window(&st);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+
+    /* 
+     * After a replay error the parser is told to stop; it notices
+     * between ops, so from a pipe it may wait for one more op or EOF.
+     * It uses st, so it is joined before st goes away.
+     */
+    if (!ok) {
+	pthread_mutex_lock(&st.lock);
+	st.stop = 1;
+	pthread_cond_signal(&st.changed);
+	pthread_mutex_unlock(&st.lock);
+    }
+    pthread_join(parser, NULL);
+    if (st.done < 0) {
+	printf("ERROR [%s]: %s\n", st.name, st.error);
+	errors++;
+	ok = 0;
+    }
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
+    if (st.gen != NULL)
+	printf("Generated %s: %" PRIu64 " ops (%" PRIu64 " freeing what was "
+	       "left), %" PRIu64 " ids\n", st.name, i, i - st.num_ops,
+	       st.gen->next_id);
+    else
+	printf("Streamed %s: %" PRIu64 " ops (header says %" PRIu64 "), "
+	       "%" PRIu64 " ids\n", st.name, i, st.num_ops, st.num_ids);
+    printf("%6s%6s%16s%14s%12s%10s%10s%8s\n", "valid", "util", "peak payload",
+	   "peak heap", "peak live", "secs", "Kops", "waited");
+    printf("%6s%5.0f%%%16" PRIu64 "%14lu%12" PRIu64 "%10.3f%10.0f%7.0f%%\n",
+	   ok ? "yes" : "no", max_heap ? 100.0 * max_live / max_heap : 0.0,
+	   max_live, max_heap, max_blocks, secs, i / 1e3 / secs,
+	   100.0 * waited / secs);
 
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
+    clear_ranges(&ranges);
+    mem_reset();
+    free(map.slots);
+    if (ok) {
+	free(st.windows);
+	if (st.gen != NULL) {
+	    free(st.gen->heap);
+	    free(st.gen);
+	}
+	else if (st.in != stdin)
+	    fclose(st.in);
+    }
+    return ok;
+}
+
+/*
+ * sweep_point - Replay a generated trace through mm, timing only the
+ *     mm calls, and record the point's peaks
+ *     Returns 0 if mm ran out of memory
+ */
+static int sweep_point(gen_t *g, sweep_t *pt)
+{
+    idmap_t map = {NULL, 0, 0};
+    idslot_t *slot;
+    streamop_t op;
+    unsigned long long start, ticks = 0;
+    size_t heap;
+    char *p;
+    int ok = 1;
+
+    idmap_resize(&map, IDMAP_MIN);
+    if (mm_init() < 0)
+	app_error("mm_init failed in sweep_point");
+    pt->ops = pt->max_live = pt->max_blocks = pt->max_heap = 0;
+    while (ok && gen_op(g, &op)) {
+	pt->ops++;
+	slot = idmap_find(&map, op.id);
+	if (op.type == ALLOC) {
+	    start = read_cycles();
+	    p = mm_malloc(op.size);
+	    ticks += ticks_since(start);
+	    if (p == NULL)
+		ok = 0;
+	    else
+		idmap_put(&map, slot, op.id, p, op.size);
+	}
+	else {
+	    start = read_cycles();
+	    mm_free(slot->p);
+	    ticks += ticks_since(start);
+	    idmap_remove(&map, slot);
+	}
+
+	if (g->live > pt->max_live)
+	    pt->max_live = g->live;
+	if (map.count > pt->max_blocks)
+	    pt->max_blocks = map.count;
+	if ((heap = mem_heapsize()) > pt->max_heap)
+	    pt->max_heap = heap;
+    }
+    pt->secs = ticks / cyc_per_ns / 1e9;
+    mem_reset();
+    free(map.slots);
+    return ok;
+}
+
+/*
+ * fit_exponent - Least-squares slope of log y against log x
+ */
+static double fit_exponent(double *x, double *y, int n)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, lx, ly;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	lx = log(x[i]);
+	ly = log(y[i]);
+	sx += lx;
+	sy += ly;
+	sxx += lx * lx;
+	sxy += lx * ly;
+    }
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+/*
+ * eval_mm_sweep - Replay the --generate model (the default one if spec
+ *     is NULL) through mm with live-set targets doubling from lo to hi
+ *     blocks and SWEEP_OPS ops per block, and fit how mm's time and
+ *     heap grow with the workload
+ *     Returns 0 if either grows faster than linearly
+ */
+static int eval_mm_sweep(char *range, char *spec)
+{
+    gen_t *g = new_generator(spec ? spec : "");
+    sweep_t pts[SWEEP_POINTS], *pt;
+    double x[SWEEP_POINTS], y[SWEEP_POINTS], best, wall, time_exp, heap_exp;
+    uint64_t lo, hi, blocks;
+    struct timespec start, end;
+    int n = 0, i, ok = 1;
+    char *comma;
+
+    comma = strchr(range, ',');
+    if (!gen_count(range, &lo) || (comma != NULL && !gen_count(comma + 1, &hi)))
+	lo = 0;
+    else if (comma == NULL)
+	hi = lo;
+    if (lo == 0 || hi < lo) {
+	sprintf(msg, "Bad --sweep range %.900s", range);
+	app_error(msg);
+    }
+    cyc_ovhd = cycles_ovhd();
+    cyc_per_ns = cycles_per_nsec();
+
+    printf("Sweeping %s from %" PRIu64 " to %" PRIu64 " live blocks\n",
+	   spec ? spec : "the default model", lo, hi);
+    printf("%12s%12s%10s%12s%8s%8s\n", "blocks", "ops", "ns/op",
+	   "heap B/blk", "util", "slope");
+    for (blocks = lo; blocks <= hi && n < SWEEP_POINTS; blocks *= 2) {
+	/* Small points are repeated for a stable best time */
+	pt = &pts[n];
+	best = DBL_MAX;
+	wall = 0;
+	do {
+	    gen_scale(g, SWEEP_OPS * blocks, blocks * g->mean_size);
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    ok = sweep_point(g, pt);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    wall += (end.tv_sec - start.tv_sec)
+		+ 1e-9 * (end.tv_nsec - start.tv_nsec);
+	    if (pt->secs < best)
+		best = pt->secs;
+	} while (ok && wall < SWEEP_MIN_SECS);
+	if (!ok) {
+	    printf("mm_malloc failed at %" PRIu64 " blocks\n", blocks);
 	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
+	}
+	pt->blocks = blocks;
+	pt->secs = best;
+
+	printf("%12" PRIu64 "%12" PRIu64 "%10.1f%12.1f%7.0f%%", blocks,
+	       pt->ops, pt->secs * 1e9 / pt->ops,
+	       (double)pt->max_heap / pt->max_blocks,
+	       100.0 * pt->max_live / pt->max_heap);
+	if (n > 0)
+	    printf("%8.2f", log(pt->secs / pts[n - 1].secs)
+		   / log((double)pt->ops / pts[n - 1].ops));
+	printf("\n");
+	fflush(stdout);
+	n++;
+
+	if (wall > SWEEP_MAX_SECS) {
+	    printf("Stopping: that point took %.0f secs\n", wall);
 	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
 	}
-	op_index++;
-	
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    free(g->heap);
+    free(g);
+
+    if (n < 2) {
+	printf("Too few points to fit\n");
+	return 1;
+    }
+
+    /* Total time against ops, and peak heap against peak payload */
+    for (i = 0; i < n; i++) {
+	x[i] = pts[i].ops;
+	y[i] = pts[i].secs;
+    }
+    time_exp = fit_exponent(x, y, n);
+    for (i = 0; i < n; i++) {
+	x[i] = pts[i].max_live;
+	y[i] = pts[i].max_heap;
+    }
+    heap_exp = fit_exponent(x, y, n);
+
+    printf("time ~ ops^%.2f%s, heap ~ payload^%.2f%s\n",
+	   time_exp, time_exp > 1 + SWEEP_SLACK ? " (SUPER-LINEAR)" : "",
+	   heap_exp, heap_exp > 1 + SWEEP_SLACK ? " (SUPER-LINEAR)" : "");
+    return time_exp <= 1 + SWEEP_SLACK && heap_exp <= 1 + SWEEP_SLACK;
 }
 
+/*****************************************************************
+ * The following routines analyze a streamed or generated trace
+ * (--analyze) without replaying it: request sizes, block lifetimes
+ * in ops, the live-set peak, how reallocs grow and how many frees
+ * are LIFO. Memory follows the live set, as in streaming replay.
+ ****************************************************************/
+
+/* Upper bounds of the realloc growth buckets, and their names */
+static const double ana_ratio_max[ANA_RATIOS] = {
+    0.5, 1, 1, 1.25, 1.5, 2, 4, HUGE_VAL
+};
+static const char *ana_ratio_name[ANA_RATIOS] = {
+    "<0.5", "<1", "1", "<=1.25", "<=1.5", "<=2", "<=4", ">4"
+};
+
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * ana_bucket - The power-of-two bucket of v: 0 for 0, else b such that
+ *     2^(b-1) <= v < 2^b
  */
-void free_trace(trace_t *trace)
+static int ana_bucket(uint64_t v)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/*
+ * ana_range - The smallest and largest values in power-of-two bucket b
+ */
+static void ana_range(int b, uint64_t *lo, uint64_t *hi)
+{
+    *lo = b ? (uint64_t)1 << (b - 1) : 0;
+    *hi = b == 0 ? 0 : b < 64 ? ((uint64_t)1 << b) - 1 : UINT64_MAX;
+}
+
+/*
+ * ana_ratio - The realloc growth bucket of ratio
+ */
+static int ana_ratio(double ratio)
+{
+    int r;
+
+    if (ratio < 0.5)
+	return 0;
+    if (ratio < 1)
+	return 1;
+    if (ratio == 1)
+	return 2;
+    for (r = 3; ratio > ana_ratio_max[r]; r++)
+	;
+    return r;
+}
+
+/*
+ * sizecount_add - Count one more request of size bytes
+ */
+static void sizecount_add(sizecount_t *sc, uint64_t size)
+{
+    uint64_t *keys = sc->keys, *counts = sc->counts;
+    size_t i, j, n = sc->mask + 1;
+
+    for (i = (size * 0x9e3779b97f4a7c15ULL) >> 16 & sc->mask;
+	 sc->keys[i] != 0 && sc->keys[i] != size + 1; i = (i + 1) & sc->mask)
+	;
+    if (sc->keys[i] != 0) {
+	sc->counts[i]++;
+	return;
+    }
+    sc->keys[i] = size + 1;
+    sc->counts[i] = 1;
+    if (++sc->count * 2 <= n)
+	return;
+
+    /* Grow and rehash */
+    sc->mask = 2 * n - 1;
+    if ((sc->keys = (uint64_t *)calloc(2 * n, sizeof(uint64_t))) == NULL
+	|| (sc->counts = (uint64_t *)malloc(2 * n * sizeof(uint64_t))) == NULL)
+	unix_error("malloc failed in sizecount_add");
+    for (i = 0; i < n; i++) {
+	if (keys[i] == 0)
+	    continue;
+	for (j = (keys[i] - 1) * 0x9e3779b97f4a7c15ULL >> 16 & sc->mask;
+	     sc->keys[j] != 0; j = (j + 1) & sc->mask)
+	    ;
+	sc->keys[j] = keys[i];
+	sc->counts[j] = counts[i];
+    }
+    free(keys);
+    free(counts);
+}
+
+/*
+ * cmp_u64 - qsort comparison for the first of a pair of uint64_ts
+ */
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * cmp_count - qsort comparison putting the largest second of a pair
+ *     of uint64_ts first
+ */
+static int cmp_count(const void *a, const void *b)
+{
+    uint64_t x = ((const uint64_t *)a)[1], y = ((const uint64_t *)b)[1];
+    return (x < y) - (x > y);
+}
+
+/*
+ * sizecount_sorted - The distinct sizes and their counts as pairs,
+ *     in order of size; free the result
+ */
+static uint64_t *sizecount_sorted(sizecount_t *sc)
+{
+    uint64_t *pairs;
+    size_t i, n = 0;
+
+    if ((pairs = (uint64_t *)malloc((sc->count + 1) * 2 * sizeof(uint64_t)))
+	== NULL)
+	unix_error("malloc failed in sizecount_sorted");
+    for (i = 0; i <= sc->mask; i++)
+	if (sc->keys[i] != 0) {
+	    pairs[2*n] = sc->keys[i] - 1;
+	    pairs[2*n + 1] = sc->counts[i];
+	    n++;
+	}
+    qsort(pairs, n, 2 * sizeof(uint64_t), cmp_u64);
+    return pairs;
+}
+
+/*
+ * compact_stack - Drop the entries of blocks that have been freed from
+ *     the LIFO stack, which otherwise only loses them from its top.
+ *     Called once they outnumber the live ones, so that the stack stays
+ *     in proportion to the live set.
+ */
+static void compact_stack(analysis_t *a, idmap_t *map)
+{
+    idslot_t *slot;
+    size_t i, n = 0;
+
+    for (i = 0; i < a->stack_count; i++) {
+	slot = idmap_find(map, a->stack[2*i]);
+	if (slot->p != NULL && slot->born == a->stack[2*i + 1]) {
+	    a->stack[2*n] = a->stack[2*i];
+	    a->stack[2*n + 1] = a->stack[2*i + 1];
+	    n++;
+	}
+    }
+    a->stack_count = n;
+}
+
+/*
+ * analyze_op - Take one op into the analysis
+ *     Returns 0 if the op doesn't fit the ones before it
+ */
+static int analyze_op(analysis_t *a, idmap_t *map, streamop_t *op)
+{
+    static char live_mark;   /* the idmap wants a non-NULL block */
+    idslot_t *slot = idmap_find(map, op->id), *top;
+    uint64_t i = a->ops++;
+    double ratio;
+
+    switch (op->type) {
+    case ALLOC:
+	if (slot->p != NULL)
+	    return 0;
+	a->allocs++;
+	a->size_pow2[ana_bucket(op->size)]++;
+	sizecount_add(&a->sizes, op->size);
+	slot->born = i;
+	idmap_put(map, slot, op->id, &live_mark, op->size);
+	if (a->stack_count >= IDMAP_MIN && a->stack_count > 2 * map->count)
+	    compact_stack(a, map);
+	if (a->stack_count == a->stack_max) {
+	    a->stack_max = a->stack_max ? 2 * a->stack_max : IDMAP_MIN;
+	    if ((a->stack = (uint64_t *)realloc(a->stack, a->stack_max * 2
+						* sizeof(uint64_t))) == NULL)
+		unix_error("realloc failed in analyze_op");
+	}
+	a->stack[2 * a->stack_count] = op->id;
+	a->stack[2 * a->stack_count + 1] = i;
+	a->stack_count++;
+	a->live += op->size;
+	break;
+
+    case REALLOC:
+	if (slot->p == NULL)
+	    return 0;
+	a->reallocs++;
+	a->size_pow2[ana_bucket(op->size)]++;
+	sizecount_add(&a->sizes, op->size);
+	ratio = slot->size ? (double)op->size / slot->size
+	    : op->size ? HUGE_VAL : 1;
+	a->ratios[ana_ratio(ratio)]++;
+	if (slot->size && op->size) {
+	    a->log_ratio_sum += log(ratio);
+	    a->log_ratios++;
+	}
+	a->live += op->size - slot->size;
+	slot->size = op->size;
+	break;
+
+    case FREE:
+	if (slot->p == NULL)
+	    return 0;
+	a->frees++;
+	a->life_pow2[ana_bucket(i - slot->born)]++;
+	a->life_sum += i - slot->born;
+
+	/* LIFO if no block allocated since this one is still live */
+	while (a->stack_count > 0) {
+	    top = idmap_find(map, a->stack[2 * a->stack_count - 2]);
+	    if (top->p != NULL && top->born == a->stack[2 * a->stack_count - 1])
+		break;
+	    a->stack_count--;
+	}
+	if (a->stack_count > 0 && a->stack[2 * a->stack_count - 2] == op->id)
+	    a->lifo_frees++;
+
+	a->live -= slot->size;
+	idmap_remove(map, slot);
+	break;
+    }
+
+    if (a->live > a->max_live) {
+	a->max_live = a->live;
+	a->peak_op = i;
+    }
+    if (map->count > a->max_blocks)
+	a->max_blocks = map->count;
+    return 1;
+}
+
+/*
+ * print_analysis - Print what analyze found for people to read
+ */
+static void print_analysis(analysis_t *a, char *name, uint64_t *pairs)
+{
+    uint64_t requests = a->allocs + a->reallocs, lo, hi;
+    int b, r;
+    size_t k;
+
+    printf("Analysis of %s: %" PRIu64 " ops, %" PRIu64 " allocs, %" PRIu64
+	   " reallocs, %" PRIu64 " frees\n", name, a->ops, a->allocs,
+	   a->reallocs, a->frees);
+    printf("Peak live set: %" PRIu64 " bytes in up to %" PRIu64 " blocks, "
+	   "at op %" PRIu64 "\n", a->max_live, a->max_blocks, a->peak_op);
+    printf("LIFO frees: %.1f%%, never freed: %" PRIu64 " blocks\n",
+	   a->frees ? 100.0 * a->lifo_frees / a->frees : 0.0, a->blocks_left);
+
+    printf("\nRequest sizes in bytes:\n%24s%12s%8s\n", "size", "requests", "%");
+    for (b = 0; b < ANA_BUCKETS; b++) {
+	if (a->size_pow2[b] == 0)
+	    continue;
+	ana_range(b, &lo, &hi);
+	printf("%11" PRIu64 " - %-10" PRIu64 "%12" PRIu64 "%7.1f%%\n", lo, hi,
+	       a->size_pow2[b], 100.0 * a->size_pow2[b] / requests);
+    }
+
+    printf("\nMost requested of %zu distinct sizes:\n%24s%12s%8s\n",
+	   a->sizes.count, "size", "requests", "%");
+    qsort(pairs, a->sizes.count, 2 * sizeof(uint64_t), cmp_count);
+    for (k = 0; k < a->sizes.count && k < ANA_TOP_SIZES; k++)
+	printf("%24" PRIu64 "%12" PRIu64 "%7.1f%%\n", pairs[2*k],
+	       pairs[2*k + 1], 100.0 * pairs[2*k + 1] / requests);
+    qsort(pairs, a->sizes.count, 2 * sizeof(uint64_t), cmp_u64);
+
+    printf("\nLifetimes in ops (mean %.0f):\n%24s%12s%8s\n",
+	   a->frees ? a->life_sum / a->frees : 0.0, "ops", "frees", "%");
+    for (b = 0; b < ANA_BUCKETS; b++) {
+	if (a->life_pow2[b] == 0)
+	    continue;
+	ana_range(b, &lo, &hi);
+	printf("%11" PRIu64 " - %-10" PRIu64 "%12" PRIu64 "%7.1f%%\n", lo, hi,
+	       a->life_pow2[b], 100.0 * a->life_pow2[b] / a->frees);
+    }
+
+    if (a->reallocs == 0)
+	return;
+    printf("\nRealloc growth, new size / old size (geometric mean %.2f):\n"
+	   "%24s%12s%8s\n", a->log_ratios ? exp(a->log_ratio_sum / a->log_ratios)
+	   : 0.0, "ratio", "reallocs", "%");
+    for (r = 0; r < ANA_RATIOS; r++)
+	if (a->ratios[r])
+	    printf("%24s%12" PRIu64 "%7.1f%%\n", ana_ratio_name[r], a->ratios[r],
+		   100.0 * a->ratios[r] / a->reallocs);
+}
+
+/*
+ * json_analysis - Write what analyze found to path as JSON
+ */
+static void json_analysis(char *path, analysis_t *a, char *name, uint64_t *pairs)
+{
+    FILE *f;
+    uint64_t lo, hi;
+    int b, r, first;
+    size_t k;
+
+    if ((f = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in json_analysis", path);
+	unix_error(msg);
+    }
+    fprintf(f, "{\n  \"trace\": ");
+    json_string(f, name);
+    fprintf(f, ",\n  \"ops\": %" PRIu64 ", \"allocs\": %" PRIu64 ", "
+	    "\"reallocs\": %" PRIu64 ", \"frees\": %" PRIu64 ",\n",
+	    a->ops, a->allocs, a->reallocs, a->frees);
+    fprintf(f, "  \"peak_live_bytes\": %" PRIu64 ", \"peak_live_blocks\": %"
+	    PRIu64 ", \"peak_op\": %" PRIu64 ",\n", a->max_live,
+	    a->max_blocks, a->peak_op);
+    fprintf(f, "  \"lifo_fraction\": %.6f, \"never_freed\": %" PRIu64 ", "
+	    "\"lifetime_mean\": %.3f, \"realloc_ratio_geomean\": %.6f,\n",
+	    a->frees ? (double)a->lifo_frees / a->frees : 0.0, a->blocks_left,
+	    a->frees ? a->life_sum / a->frees : 0.0,
+	    a->log_ratios ? exp(a->log_ratio_sum / a->log_ratios) : 0.0);
+
+    /* Histograms as [lo, hi, count] for each nonempty bucket */
+    fprintf(f, "  \"size_pow2\": [");
+    for (b = 0, first = 1; b < ANA_BUCKETS; b++)
+	if (a->size_pow2[b]) {
+	    ana_range(b, &lo, &hi);
+	    fprintf(f, "%s[%" PRIu64 ", %" PRIu64 ", %" PRIu64 "]",
+		    first ? "" : ", ", lo, hi, a->size_pow2[b]);
+	    first = 0;
+	}
+    fprintf(f, "],\n  \"lifetime_pow2\": [");
+    for (b = 0, first = 1; b < ANA_BUCKETS; b++)
+	if (a->life_pow2[b]) {
+	    ana_range(b, &lo, &hi);
+	    fprintf(f, "%s[%" PRIu64 ", %" PRIu64 ", %" PRIu64 "]",
+		    first ? "" : ", ", lo, hi, a->life_pow2[b]);
+	    first = 0;
+	}
+    fprintf(f, "],\n  \"realloc_ratio\": {");
+    for (r = 0; r < ANA_RATIOS; r++)
+	fprintf(f, "%s\"%s\": %" PRIu64, r ? ", " : "", ana_ratio_name[r],
+		a->ratios[r]);
+
+    /* Every exact size as [size, count], in order of size */
+    fprintf(f, "},\n  \"sizes\": [");
+    for (k = 0; k < a->sizes.count; k++)
+	fprintf(f, "%s[%" PRIu64 ", %" PRIu64 "]", k ? ", " : "",
+		pairs[2*k], pairs[2*k + 1]);
+    fprintf(f, "]\n}\n");
+    fclose(f);
+}
+
+/*
+ * eval_analyze - Analyze the trace in filename (stdin if "-"), or the
+ *     one generated from spec if filename is NULL, and print the
+ *     results, also writing them to json_file if it is set
+ *     Returns 0 if the trace is malformed
+ */
+static int eval_analyze(char *filename, char *spec)
+{
+    stream_t st;
+    pthread_t parser;
+    idmap_t map = {NULL, 0, 0};
+    analysis_t *a;
+    window_t *w;
+    uint64_t *pairs;
+    double waited = 0;
+    int k, ok = 1;
+
+    if (filename != NULL)
+	open_stream(&st, filename);
+    else
+	open_generated(&st, spec);
+    idmap_resize(&map, IDMAP_MIN);
+    if ((a = (analysis_t *)calloc(1, sizeof(analysis_t))) == NULL
+	|| (a->sizes.keys = (uint64_t *)calloc(IDMAP_MIN, sizeof(uint64_t)))
+	== NULL
+	|| (a->sizes.counts = (uint64_t *)malloc(IDMAP_MIN * sizeof(uint64_t)))
+	== NULL)
+	unix_error("malloc failed in eval_analyze");
+    a->sizes.mask = IDMAP_MIN - 1;
+    if (pthread_create(&parser, NULL, stream_main, &st) != 0)
+	unix_error("pthread_create failed in eval_analyze");
+
+    while (ok && (w = next_window(&st, &waited)) != NULL) {
+	for (k = 0; k < w->count; k++)
+	    if (!analyze_op(a, &map, &w->ops[k])) {
+		sprintf(msg, "op %" PRIu64 " on id %" PRIu64 " doesn't follow "
+			"the ops before it", a->ops - 1, w->ops[k].id);
+		printf("ERROR [%s]: %s\n", st.name, msg);
+		ok = 0;
+		break;
+	    }
+	drain_window(&st);
+    }
+
+    /* As in eval_mm_stream, the parser is stopped and joined */
+    if (!ok) {
+	pthread_mutex_lock(&st.lock);
+	st.stop = 1;
+	pthread_cond_signal(&st.changed);
+	pthread_mutex_unlock(&st.lock);
+    }
+    pthread_join(parser, NULL);
+    if (ok && st.done < 0) {
+	printf("ERROR [%s]: %s\n", st.name, st.error);
+	ok = 0;
+    }
+    if (!ok)
+	return 0;
+
+    a->blocks_left = map.count;
+    pairs = sizecount_sorted(&a->sizes);
+    print_analysis(a, st.name, pairs);
+    if (json_file != NULL)
+	json_analysis(json_file, a, st.name, pairs);
+
+    free(pairs);
+    free(a->sizes.keys);
+    free(a->sizes.counts);
+    free(a->stack);
+    free(a);
+    free(map.slots);
+    free(st.windows);
+    if (st.gen != NULL) {
+	free(st.gen->heap);
+	free(st.gen);
+    }
+    else if (st.in != stdin)
+	fclose(st.in);
+    return 1;
 }
 
 /**********************************************************************
@@ -659,6 +3330,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     return 1;
 }
 
+/*
+ * cmp_size - qsort comparison for size_ts
+ */
+static int cmp_size(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
 /* 
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
@@ -670,13 +3350,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats)
 {   
     int i;
+    int peak_op = prof_rate ? peak_live_op(trace) : -1;
+    char path[MAXLINE];
     int index;
     int size, newsize, oldsize;
     size_t max_total_size = 0, max_heap_size = 0;
-    size_t heap_size = 0, total_size = 0;
+    size_t heap_size = 0, total_size = 0, usable_size = 0, peak_usable = 0;
+    size_t *heap_sizes;
+    int peak_heap_op = -1;
+    FILE *timeline = NULL;
+    mm_stats_t heap_stats;
     double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
     int ratio_exp;
     char *p;
@@ -685,6 +3371,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
     /* initialize the heap and the mm malloc package */
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    if (prof_rate && mm_profile_start(prof_rate) < 0)
+	unix_error("mm_profile_start failed in eval_mm_util");
+    if ((heap_sizes = (size_t *)malloc(trace->num_ops * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in eval_mm_util");
+    if (timeline_every)
+	timeline = timeline_open(tracenum);
+    stats->heap_area = stats->live_area = 0;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -703,6 +3396,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    /* Keep track of current total size
 	     * of all allocated blocks */
 	    total_size += size;
+	    usable_size += mm_usable_size(p);
 
             break;
 
@@ -715,6 +3409,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    if ((newp = mm_malloc(newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
+	    usable_size += mm_usable_size(newp) - mm_usable_size(oldp);
             mm_free(oldp);
 
 	    /* Remember region and size */
@@ -732,6 +3427,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
+	    usable_size -= mm_usable_size(p);
 	    mm_free(p);
 	    
 	    /* Keep track of current total size
@@ -745,6 +3441,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 
         }
 
+	/* Optionally write the heap profile at the live peak */
+	if (prof_rate && i == peak_op) {
+	    sprintf(path, "mdriver-heap.%d.prof", tracenum);
+	    if (mm_profile_dump(path) < 0)
+		unix_error("mm_profile_dump failed in eval_mm_util");
+	}
+
     	    
         /* Update statistics */
         max_total_size = ((total_size > max_total_size) ?
@@ -752,9 +3455,25 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
                           : max_total_size);
 
         heap_size = mem_heapsize();
-        if (heap_size > max_heap_size)
+        if (heap_size > max_heap_size) {
           max_heap_size = heap_size;
 
+          peak_heap_op = i;
+          peak_usable = usable_size;
+          stats->foot_heap = heap_size;
+          stats->foot_payload = total_size;
+          stats->foot_slack = usable_size - total_size;
+        }
+        if (i == snap_op)
+          snapshot(tracenum);
+
+        /* Footprint over time */
+        stats->heap_area += heap_size;
+        stats->live_area += total_size;
+        heap_sizes[i] = heap_size;
+        if (timeline != NULL && i % timeline_every == 0)
+          timeline_put(timeline, i, total_size, heap_size);
+
         ratio = (double)(total_size + 1) / (heap_size + 1);
 
         ratio_frac = frexp(ratio, &ratio_exp);
@@ -762,23 +3481,180 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
         accum_ratio_frac *= ratio_frac;
         accum_ratio_exp += ratio_exp;
 
-        accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
-        accum_ratio_exp += ratio_exp;
-        
-        // printf("%ld %ld %f\n", total_size, heap_size, ratio);
-    }
+        accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
+        accum_ratio_exp += ratio_exp;
+        
+        // printf("%ld %ld %f\n", total_size, heap_size, ratio);
+    }
+
+    mem_reset();
+    if (prof_rate)
+	mm_profile_stop();
+    if (timeline != NULL)
+	fclose(timeline);
+
+    /* Break the peak footprint down (-v) and snapshot it (-S peak),
+       with one replay up to the op that reached it rather than work at
+       every new peak along the way */
+    if ((verbose || snap_op == SNAP_PEAK) && peak_heap_op >= 0) {
+	replay_prefix(trace, peak_heap_op);
+	if (verbose) {
+	    mm_stats(&heap_stats);
+	    stats->foot_header = heap_stats.alloc_bytes - peak_usable;
+	    stats->foot_free = heap_stats.free_bytes;
+	    stats->foot_chunk = mem_heapsize() - heap_stats.alloc_bytes
+		- heap_stats.free_bytes;
+	}
+	if (snap_op == SNAP_PEAK)
+	    snapshot(tracenum);
+	mem_reset();
+    }
+
+    qsort(heap_sizes, trace->num_ops, sizeof(size_t), cmp_size);
+    stats->heap_p95 = heap_sizes[(int)(trace->num_ops * 0.95)];
+    free(heap_sizes);
+
+    ratio = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
+
+    // printf("%ld %f\n", max_total_size, ratio);
+
+    stats->inst_util = ratio;
+
+    return (double)max_total_size / max_heap_size;;
+}
+
+/*
+ * timeline_open - Start mdriver-timeline.<tracenum>.csv, or .bin
+ */
+static FILE *timeline_open(int tracenum)
+{
+    char path[MAXLINE];
+    FILE *f;
+
+    sprintf(path, "mdriver-timeline.%d.%s", tracenum, timeline_bin ? "bin" : "csv");
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error("fopen failed in timeline_open");
+    if (timeline_bin)
+	fwrite(TIMELINE_MAGIC, 1, 8, f);
+    else
+	fprintf(f, "op,live,heap,free,chunks\n");
+    return f;
+}
+
+/*
+ * timeline_put - Add the footprint after op to a timeline
+ */
+static void timeline_put(FILE *f, int op, size_t live, size_t heap)
+{
+    mm_stats_t heap_stats;
+    timeline_t rec;
+
+    mm_stats(&heap_stats);
+    rec.op = op;
+    rec.live = live;
+    rec.heap = heap;
+    rec.free = heap_stats.free_bytes;
+    rec.chunks = heap_stats.chunks;
+    if (timeline_bin)
+	fwrite(&rec, sizeof(rec), 1, f);
+    else
+	fprintf(f, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+		rec.op, rec.live, rec.heap, rec.free, rec.chunks);
+}
+
+/*
+ * snapshot - Write a map of the heap to mdriver-heap.<tracenum>.snap
+ */
+static void snapshot(int tracenum)
+{
+    char path[MAXLINE];
+
+    sprintf(path, "mdriver-heap.%d.snap", tracenum);
+    if (mm_snapshot(path) < 0)
+	unix_error("mm_snapshot failed");
+}
 
-    mem_reset();
+/*
+ * peak_live_op - Return the index of the first op after which the total
+ *    size of the allocated payloads is at its maximum
+ */
+static int peak_live_op(trace_t *trace)
+{
+    int i, index, peak_op = 0;
+    size_t total_size = 0, max_total_size = 0;
 
-    ratio = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    total_size += trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total_size += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+        case FREE:
+	    total_size -= trace->block_sizes[index];
+	    break;
+	}
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    peak_op = i;
+	}
+    }
 
-    // printf("%ld %f\n", max_total_size, ratio);
+    return peak_op;
+}
 
-    *inst_ratio = ratio;
+/*
+ * replay_prefix - Start mm afresh and replay ops 0 to last_op of a trace
+ *    that has already passed eval_mm_valid, so that the heap is as the
+ *    util pass had it after last_op
+ */
+static void replay_prefix(trace_t *trace, int last_op)
+{
+    int i, index;
+    char *p;
 
-    return (double)max_total_size / max_heap_size;;
+    if (mm_init() < 0)
+	app_error("mm_init failed in replay_prefix");
+    for (i = 0; i <= last_op && i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in replay_prefix");
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC: /* mm_malloc + mm_free */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in replay_prefix");
+	    mm_free(trace->blocks[index]);
+	    trace->blocks[index] = p;
+	    break;
+        case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+    }
 }
 
+/*
+ * eval_mm_trim - Replay a trace up to its live peak and see what
+ *    mm_trim(0) hands back there (-T). This is a replay of its own, so
+ *    the graded util pass never sees a trimmed heap.
+ */
+static void eval_mm_trim(trace_t *trace, stats_t *stats)
+{
+    replay_prefix(trace, peak_live_op(trace));
+    stats->trim_heap[0] = mem_heapsize();
+    stats->trim_rss[0] = mem_residentsize();
+    stats->trim_released = mm_trim(0);
+    stats->trim_heap[1] = mem_heapsize();
+    stats->trim_rss[1] = mem_residentsize();
+    mem_reset();
+}
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -788,11 +3664,25 @@ static void eval_mm_speed(void *ptr)
 {
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    speed_t *speed = (speed_t *)ptr;
+    trace_t *trace = speed->trace;
+    struct rusage start, end;
+    unsigned long long ticks;
+
+    /* An earlier run ran out of memory; the rest are not worth timing */
+    if (speed->failed_op >= 0)
+	return;
 
     /* Reset the heap and initialize the mm package */
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    if (reserve_bytes) {
+	ticks = read_cycles();
+	if (mm_reserve(reserve_bytes, MM_RESERVE_POPULATE) < 0)
+	    app_error("mm_reserve failed in eval_mm_speed");
+	speed->reserve_ticks += read_cycles() - ticks;
+    }
+    getrusage(RUSAGE_SELF, &start);
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -801,8 +3691,11 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
+            if ((p = mm_malloc(size)) == NULL) {
+		speed->failed_op = i;
+		mem_reset();
+		return;
+	    }
             trace->blocks[index] = p;
             break;
 
@@ -810,8 +3703,11 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_malloc(newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
+            if ((newp = mm_malloc(newsize)) == NULL) {
+		speed->failed_op = i;
+		mem_reset();
+		return;
+	    }
             mm_free(oldp);
             trace->blocks[index] = newp;
             break;
@@ -826,7 +3722,463 @@ static void eval_mm_speed(void *ptr)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+    getrusage(RUSAGE_SELF, &end);
+    speed->minflt += end.ru_minflt - start.ru_minflt;
+    speed->majflt += end.ru_majflt - start.ru_majflt;
+    speed->runs++;
+    mem_reset();
+}
+
+/*
+ * touch_read - Read the first n bytes of a block, a word at a time
+ */
+static unsigned long touch_read(char *p, size_t n)
+{
+    unsigned long sum = 0;
+    size_t i;
+
+    for (i = 0; i + sizeof(long) <= n; i += sizeof(long))
+	sum += *(unsigned long *)(p + i);
+    return sum;
+}
+
+/*
+ * replay_touch - Run a trace through mm or libc malloc the way an
+ *    application would use the blocks: write the first touch_bytes of
+ *    each block when it is allocated, read them back before it is
+ *    freed and, every touch_every ops, read every live block in the
+ *    order of the trace's ids (allocation order). The time spent
+ *    touching is counted separately in speed->touch_ticks.
+ */
+static void replay_touch(speed_t *speed, int libc)
+{
+    trace_t *trace = speed->trace;
+    int i, j, index, size;
+    char *p;
+    size_t n;
+    unsigned long sum = 0;
+    unsigned long long start, ticks = 0;
+
+    if (!libc && mm_init() < 0)
+	app_error("mm_init failed in replay_touch");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc, then write the block */
+        case REALLOC: /* malloc, copy the old block's bytes, free it */
+            if ((p = libc ? malloc(size) : mm_malloc(size)) == NULL)
+		app_error("malloc error in replay_touch");
+	    start = read_cycles();
+	    n = size < touch_bytes ? size : touch_bytes;
+	    if (trace->blocks[index] != NULL)
+		sum += touch_read(trace->blocks[index], trace->block_sizes[index]);
+	    memset(p, i, n);
+	    ticks += ticks_since(start);
+	    if (trace->blocks[index] != NULL) {
+		if (libc)
+		    free(trace->blocks[index]);
+		else
+		    mm_free(trace->blocks[index]);
+	    }
+            trace->blocks[index] = p;
+	    trace->block_sizes[index] = n;
+            break;
+        case FREE: /* read the block back, then free */
+	    p = trace->blocks[index];
+	    start = read_cycles();
+	    sum += touch_read(p, trace->block_sizes[index]);
+	    ticks += ticks_since(start);
+	    if (libc)
+		free(p);
+	    else
+		mm_free(p);
+	    trace->blocks[index] = NULL;
+            break;
+	default:
+	    app_error("Nonexistent request type in replay_touch");
+        }
+
+	/* Walk the live blocks now and then, as a traversal would */
+	if (touch_every && (i+1) % touch_every == 0) {
+	    start = read_cycles();
+	    for (j = 0; j < trace->num_ids; j++)
+		if (trace->blocks[j] != NULL)
+		    sum += touch_read(trace->blocks[j], trace->block_sizes[j]);
+	    ticks += ticks_since(start);
+	}
+    }
+
+    if (!libc)
+	mem_reset();
+    touch_sink += sum;
+    speed->touch_ticks += ticks;
+    speed->touch_runs++;
+}
+
+/*
+ * eval_mm_touch, eval_libc_touch - The memory-touch workload, timed by
+ *    fsecs
+ */
+static void eval_mm_touch(void *ptr)
+{
+    replay_touch((speed_t *)ptr, 0);
+}
+
+static void eval_libc_touch(void *ptr)
+{
+    replay_touch((speed_t *)ptr, 1);
+}
+
+/*
+ * xthread_main - One thread of the false-sharing benchmark: take turns
+ *    with the others allocating small blocks, so that blocks of different
+ *    threads end up next to each other, then keep writing to its own
+ */
+static void *xthread_main(void *arg)
+{
+    xthread_t *self = (xthread_t *)arg;
+    xshare_t *share = self->share;
+    char **mine = share->blocks + self->id * XBLOCKS;
+    int i, r;
+
+    for (i = 0; i < XBLOCKS; i++) {
+	pthread_mutex_lock(&share->lock);
+	while (share->turn % share->nthreads != self->id)
+	    pthread_cond_wait(&share->next, &share->lock);
+	if ((mine[i] = mm_malloc(XSIZE)) == NULL)
+	    app_error("mm_malloc failed in xthread_main");
+	memset(mine[i], 0, XSIZE);
+	share->turn++;
+	pthread_cond_broadcast(&share->next);
+	pthread_mutex_unlock(&share->lock);
+    }
+
+    pthread_barrier_wait(&share->start);
+    for (r = 0; r < XROUNDS; r++)
+	for (i = 0; i < XBLOCKS; i++)
+	    (*(volatile long *)mine[i])++;
+    return NULL;
+}
+
+/*
+ * cmp_xblock - qsort comparison for xblock_ts by address
+ */
+static int cmp_xblock(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const xblock_t *)a)->p;
+    uintptr_t y = (uintptr_t)((const xblock_t *)b)->p;
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_false_sharing - Time nthreads threads writing to their own small
+ *    blocks, with mm placing blocks packed or on cache lines of their own
+ */
+static void eval_false_sharing(int nthreads, int lines, xresult_t *res)
+{
+    xshare_t share;
+    xthread_t *threads;
+    pthread_t *tids;
+    xblock_t *sorted;
+    struct timespec start, end;
+    uintptr_t line, last_line = 0;
+    int i, n = nthreads * XBLOCKS;
+
+    share.nthreads = nthreads;
+    share.turn = 0;
+    pthread_mutex_init(&share.lock, NULL);
+    pthread_cond_init(&share.next, NULL);
+    pthread_barrier_init(&share.start, NULL, nthreads + 1);
+    threads = (xthread_t *)malloc(nthreads * sizeof(xthread_t));
+    tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    share.blocks = (char **)malloc(n * sizeof(char *));
+    sorted = (xblock_t *)malloc(n * sizeof(xblock_t));
+    if (!threads || !tids || !share.blocks || !sorted)
+	unix_error("malloc failed in eval_false_sharing");
+
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_false_sharing");
+    mm_set_placement(0, lines);
+
+    /* mm switches to lines once a second thread calls it, so be the
+       first, and every benchmark thread's blocks come after the switch */
+    mm_free(mm_malloc(1));
+
+    for (i = 0; i < nthreads; i++) {
+	threads[i].share = &share;
+	threads[i].id = i;
+	if (pthread_create(&tids[i], NULL, xthread_main, &threads[i]) != 0)
+	    unix_error("pthread_create failed in eval_false_sharing");
+    }
+    pthread_barrier_wait(&share.start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    res->mwrites = (double)n * XROUNDS / 1e6 /
+	((end.tv_sec - start.tv_sec) + 1e-9*(end.tv_nsec - start.tv_nsec));
+    res->util = (double)n * XSIZE / mem_heapsize();
+
+    /* Count the lines where a block of one thread meets another's.
+       In address order, any two blocks on one line have only blocks on
+       that line between them, so neighbours are enough to look at. */
+    for (i = 0; i < n; i++) {
+	sorted[i].p = share.blocks[i];
+	sorted[i].owner = i / XBLOCKS;
+    }
+    qsort(sorted, n, sizeof(xblock_t), cmp_xblock);
+    res->shared = 0;
+    for (i = 1; i < n; i++) {
+	line = (uintptr_t)sorted[i].p / XLINE;
+	if (((uintptr_t)sorted[i-1].p + XSIZE - 1) / XLINE == line
+	    && sorted[i-1].owner != sorted[i].owner
+	    && (res->shared == 0 || line != last_line)) {
+	    res->shared++;
+	    last_line = line;
+	}
+    }
+
+    for (i = 0; i < n; i++)
+	mm_free(share.blocks[i]);
+    mm_set_placement(0, 0);
     mem_reset();
+
+    pthread_barrier_destroy(&share.start);
+    pthread_cond_destroy(&share.next);
+    pthread_mutex_destroy(&share.lock);
+    free(sorted);
+    free(share.blocks);
+    free(tids);
+    free(threads);
+}
+
+/*
+ * limit_address_space - Set the soft RLIMIT_AS so that only headroom
+ *    more bytes can be mapped than the process has mapped right now,
+ *    once mdriver's own tables are in place, or lift it if headroom is 0.
+ *    The hard limit is left alone, so the cap can be moved per trace.
+ */
+static void limit_address_space(size_t headroom)
+{
+    FILE *statm;
+    unsigned long vm_pages;
+    struct rlimit rl;
+    void *p;
+
+    if (getrlimit(RLIMIT_AS, &rl) < 0)
+	unix_error("getrlimit failed in limit_address_space");
+    if (headroom == 0) {
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_AS, &rl) < 0)
+	    unix_error("setrlimit failed in limit_address_space");
+	return;
+    }
+
+    /* The page map makes its tables on the first mem_map, so make them
+       now rather than out of mm's share */
+    if ((p = mem_map(mem_pagesize())) == (void *)-1)
+	unix_error("mem_map failed in limit_address_space");
+    mem_unmap(p, mem_pagesize());
+
+    if ((statm = fopen("/proc/self/statm", "r")) == NULL)
+	unix_error("Could not open /proc/self/statm");
+    if (fscanf(statm, "%lu", &vm_pages) != 1)
+	app_error("Could not read /proc/self/statm");
+    fclose(statm);
+
+    rl.rlim_cur = vm_pages * sysconf(_SC_PAGESIZE) + headroom;
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+	rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_AS, &rl) < 0)
+	unix_error("setrlimit failed in limit_address_space");
+}
+
+/*
+ * count_reclaim - The reclaim hook mdriver gives mm: it has no caches
+ *    of its own to shed, so it only counts how often it was asked
+ */
+static size_t count_reclaim(size_t bytes, void *arg)
+{
+    (*(int *)arg)++;
+    return 0;
+}
+
+/*
+ * ticks_since - Counter ticks since start, less the cost of reading
+ *    the counter
+ */
+static unsigned long long ticks_since(unsigned long long start)
+{
+    unsigned long long ticks = read_cycles() - start;
+    return ticks > cyc_ovhd ? ticks - cyc_ovhd : 0;
+}
+
+/*
+ * size_class - The latency size class of a request of size bytes
+ */
+static int size_class(size_t size)
+{
+    int c;
+    size_t limit = 64;
+
+    for (c = 0; c < LAT_SIZES-1 && size > limit; c++)
+	limit <<= 3;
+    return c;
+}
+
+/*
+ * hist_add - Count one op that took ticks counter ticks
+ */
+static void hist_add(hist_t *h, unsigned long long ticks)
+{
+    int e;
+
+    h->count++;
+    if (ticks > h->max)
+	h->max = ticks;
+    if (ticks < HIST_SUB) {
+	h->buckets[ticks]++;
+	return;
+    }
+    e = 63 - __builtin_clzll(ticks); /* 2^e <= ticks < 2^(e+1) */
+    h->buckets[(e - HIST_SUB_BITS) * HIST_SUB + (ticks >> (e - HIST_SUB_BITS))]++;
+}
+
+/*
+ * hist_merge - Add the counts of h to all
+ */
+static void hist_merge(hist_t *all, hist_t *h)
+{
+    int b;
+
+    all->count += h->count;
+    if (h->max > all->max)
+	all->max = h->max;
+    for (b = 0; b < HIST_BUCKETS; b++)
+	all->buckets[b] += h->buckets[b];
+}
+
+/*
+ * hist_value - The latency in ticks of the op of rank q*count, taken as
+ *    the middle of its bucket
+ */
+static double hist_value(hist_t *h, double q)
+{
+    long rank = (long)(h->count * q), seen = 0;
+    int b, e;
+    double lo, width;
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+	if ((seen += h->buckets[b]) > rank)
+	    break;
+    if (b < HIST_SUB)
+	return b;
+    e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    width = (double)(1ULL << (e - HIST_SUB_BITS));
+    lo = (b % HIST_SUB + HIST_SUB) * width;
+    return lo + width/2 < h->max ? lo + width/2 : h->max;
+}
+
+/*
+ * hist_summary - Percentiles of h in nsecs
+ */
+static void hist_summary(hist_t *h, latency_t *lat)
+{
+    lat->count = h->count;
+    if (h->count == 0)
+	return;
+    lat->p50 = hist_value(h, 0.50) / cyc_per_ns;
+    lat->p99 = hist_value(h, 0.99) / cyc_per_ns;
+    lat->p999 = hist_value(h, 0.999) / cyc_per_ns;
+    lat->max = h->max / cyc_per_ns;
+}
+
+/*
+ * eval_latency - Run a trace once through mm, or libc malloc, timing
+ *    every request on its own with the cycle counter, optionally with
+ *    mm's background maintenance thread running. The percentiles over
+ *    all ops go in all, and if oplat isn't NULL, those for each op type
+ *    and request size class go there. A realloc is a malloc and a free,
+ *    as in the timed runs.
+ */
+static void eval_latency(trace_t *trace, int libc, int background,
+			 latency_t *all, latency_t oplat[LAT_OPS][LAT_SIZES])
+{
+    int i, index, type, size;
+    char *p;
+    hist_t *hists, *total;
+    unsigned long long start, ticks;
+    size_t peak_heap = 0;
+
+    /* One histogram per op type and size class, then the total */
+    if ((hists = (hist_t *)calloc(LAT_OPS*LAT_SIZES + 1, sizeof(hist_t))) == NULL)
+	unix_error("calloc failed in eval_latency");
+    total = &hists[LAT_OPS*LAT_SIZES];
+
+    if (!libc && mm_init() < 0)
+	app_error("mm_init failed in eval_latency");
+    if (!libc && background && mm_background_start() < 0)
+	unix_error("mm_background_start failed in eval_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	type = trace->ops[i].type;
+	size = trace->ops[i].size;
+	start = read_cycles();
+        switch (type) {
+        case ALLOC: /* malloc */
+            if ((p = libc ? malloc(size) : mm_malloc(size)) == NULL)
+		app_error("malloc error in eval_latency");
+            trace->blocks[index] = p;
+            break;
+	case REALLOC: /* malloc + free */
+            if ((p = libc ? malloc(size) : mm_malloc(size)) == NULL)
+		app_error("realloc error in eval_latency");
+	    if (libc)
+		free(trace->blocks[index]);
+	    else
+		mm_free(trace->blocks[index]);
+            trace->blocks[index] = p;
+            break;
+        case FREE: /* free */
+	    if (libc)
+		free(trace->blocks[index]);
+	    else
+		mm_free(trace->blocks[index]);
+            break;
+	default:
+	    app_error("Nonexistent request type in eval_latency");
+        }
+	ticks = ticks_since(start);
+	if (!libc && mem_heapsize() > peak_heap)
+	    peak_heap = mem_heapsize();
+
+	/* A free falls in the size class of the block it frees */
+	if (type == FREE)
+	    size = trace->block_sizes[index];
+	else
+	    trace->block_sizes[index] = size;
+	hist_add(&hists[type*LAT_SIZES + size_class(size)], ticks);
+    }
+
+    if (!libc) {
+	if (background)
+	    mm_background_stop();
+	mem_reset();
+    }
+
+    for (i = 0; i < LAT_OPS*LAT_SIZES; i++) {
+	hist_merge(total, &hists[i]);
+	if (oplat != NULL)
+	    hist_summary(&hists[i], &oplat[i / LAT_SIZES][i % LAT_SIZES]);
+    }
+    hist_summary(total, all);
+    all->peak_heap = peak_heap;
+    free(hists);
 }
 
 /*
@@ -865,12 +4217,167 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
-	}
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * libc_heap - Bytes libc malloc holds from the OS: its arenas and
+ *    mmap'd blocks per mallinfo2, and if in_use isn't NULL, how many
+ *    of them are in allocated blocks. Without mallinfo2, both are the
+ *    process's mapped bytes from /proc/self/statm.
+ */
+static size_t libc_heap(size_t *in_use)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+
+    if (in_use != NULL)
+	*in_use = mi.uordblks + mi.hblkhd;
+    return mi.arena + mi.hblkhd;
+#else
+    static int fd = -1;
+    char buf[64];
+    ssize_t n;
+    size_t bytes = 0;
+
+    if (fd < 0 && (fd = open("/proc/self/statm", O_RDONLY)) < 0)
+	unix_error("open /proc/self/statm failed in libc_heap");
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+	buf[n] = '\0';
+	bytes = strtoul(buf, NULL, 10) * getpagesize();
+    }
+    if (in_use != NULL)
+	*in_use = bytes;
+    return bytes;
+#endif
+}
+
+/*
+ * libc_util_main - The thread eval_libc_util runs the trace on
+ */
+static void *libc_util_main(void *arg)
+{
+    trace_t *trace = ((libc_util_t *)arg)->trace;
+    stats_t *stats = ((libc_util_t *)arg)->stats;
+    size_t *heap_sizes = ((libc_util_t *)arg)->heap_sizes;
+    int i, index, size, newsize, oldsize;
+    size_t base, heap_size, total_size = 0, max_total_size = 0;
+    size_t max_heap_size = 0;
+    double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
+    int ratio_exp;
+    char *p;
+
+    /* This thread's first malloc gives it an arena of its own */
+    base = libc_heap(NULL);
+    stats->heap_area = stats->live_area = 0;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		app_error("malloc failed in eval_libc_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+            break;
+
+	case REALLOC: /* realloc */
+	    newsize = trace->ops[i].size;
+	    oldsize = trace->block_sizes[index];
+	    if ((p = realloc(trace->blocks[index], newsize)) == NULL)
+		app_error("realloc failed in eval_libc_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = newsize;
+	    total_size += newsize - oldsize;
+	    break;
+
+        case FREE: /* free */
+	    free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_libc_util");
+        }
+
+        if (total_size > max_total_size)
+	    max_total_size = total_size;
+	heap_size = libc_heap(NULL);
+	heap_size = heap_size > base ? heap_size - base : 0;
+	if (heap_size > max_heap_size) {
+	    max_heap_size = heap_size;
+	    stats->foot_heap = heap_size;
+	    stats->foot_payload = total_size;
+	}
+	stats->heap_area += heap_size;
+	stats->live_area += total_size;
+	heap_sizes[i] = heap_size;
+
+        ratio = (double)(total_size + 1) / (heap_size + 1);
+        ratio_frac = frexp(ratio, &ratio_exp);
+        accum_ratio_frac *= ratio_frac;
+        accum_ratio_exp += ratio_exp;
+        accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
+        accum_ratio_exp += ratio_exp;
+    }
+
+    qsort(heap_sizes, trace->num_ops, sizeof(size_t), cmp_size);
+    stats->heap_p95 = heap_sizes[(int)(trace->num_ops * 0.95)];
+
+    stats->inst_util = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
+    stats->util = max_heap_size ? (double)max_total_size / max_heap_size : 0;
+    return NULL;
+}
+
+/*
+ * eval_libc_util - Evaluate the space utilization of libc malloc the
+ *    way eval_mm_util does for mm, with libc's heap taken as the bytes
+ *    it gets from the OS during the run. The run is in a child process,
+ *    on a new thread, so that it starts from a fresh arena just as mm
+ *    starts from a fresh heap. In mdriver's own arena, free memory left
+ *    by earlier traces would be reused and go uncounted.
+ */
+static void eval_libc_util(trace_t *trace, stats_t *stats)
+{
+    libc_util_t args;
+    stats_t *shared;
+    pthread_t tid;
+    pid_t pid;
+    int status;
+
+    if ((shared = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	unix_error("mmap failed in eval_libc_util");
+    if ((args.heap_sizes = (size_t *)malloc(trace->num_ops * sizeof(size_t)))
+	== NULL)
+	unix_error("malloc failed in eval_libc_util");
+    *shared = *stats;
+    args.trace = trace;
+    args.stats = shared;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+	unix_error("fork failed in eval_libc_util");
+    if (pid == 0) {
+	if (pthread_create(&tid, NULL, libc_util_main, &args) != 0)
+	    _exit(1);
+	pthread_join(tid, NULL);
+	_exit(0);
     }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+	|| WEXITSTATUS(status) != 0)
+	app_error("libc utilization run failed in eval_libc_util");
 
-    return 1;
+    *stats = *shared;
+    munmap(shared, sizeof(stats_t));
+    free(args.heap_sizes);
 }
 
 /* 
@@ -915,6 +4422,510 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*****************************************************************
+ * The following routines replay a trace with a thread column on
+ * one worker thread per trace thread. Each worker runs its own
+ * requests in file order. A request on a block waits for the request
+ * before it on the same id if another thread made that one, so a
+ * block is never freed before it is allocated, across threads too.
+ * Requests on unrelated blocks run in whatever order the threads
+ * reach them.
+ ****************************************************************/
+
+/*
+ * creplay_op - Carry out one request. mm calls are made under the
+ *     share's lock, since mm isn't thread-safe. As in the timed runs, a
+ *     realloc is a malloc and a free. Returns 0 if an allocation failed.
+ */
+static int creplay_op(creplay_t *share, traceop_t *op)
+{
+    char **block = &share->trace->blocks[op->index];
+    char *p = NULL;
+    int libc = share->libc;
+
+    if (!libc)
+	pthread_mutex_lock(&share->mm_lock);
+    switch (op->type) {
+    case ALLOC:
+	p = *block = libc ? malloc(op->size) : mm_malloc(op->size);
+	break;
+    case REALLOC:
+	if ((p = libc ? malloc(op->size) : mm_malloc(op->size)) == NULL)
+	    break;
+	if (libc)
+	    free(*block);
+	else
+	    mm_free(*block);
+	*block = p;
+	break;
+    case FREE:
+	if (libc)
+	    free(*block);
+	else
+	    mm_free(*block);
+	p = *block;
+	break;
+    }
+    if (!libc)
+	pthread_mutex_unlock(&share->mm_lock);
+    return p != NULL;
+}
+
+/*
+ * creplay_main - A worker: replay one trace thread's requests, timing
+ *     each, and the time spent waiting on other threads apart
+ */
+static void *creplay_main(void *arg)
+{
+    cworker_t *self = (cworker_t *)arg;
+    creplay_t *share = self->share;
+    struct timespec t0, t1;
+    unsigned long long start;
+    int i, dep;
+
+    pthread_barrier_wait(&share->start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = share->first[self->thread]; i >= 0; i = share->next[i]) {
+	if ((dep = share->dep[i]) >= 0
+	    && !__atomic_load_n(&share->done[dep], __ATOMIC_ACQUIRE)) {
+	    start = read_cycles();
+	    while (!__atomic_load_n(&share->done[dep], __ATOMIC_ACQUIRE)
+		   && !__atomic_load_n(&share->failed, __ATOMIC_RELAXED))
+		sched_yield();
+	    self->waited += ticks_since(start);
+	}
+	if (__atomic_load_n(&share->failed, __ATOMIC_RELAXED))
+	    break;
+
+	start = read_cycles();
+	if (!creplay_op(share, &share->trace->ops[i])) {
+	    malloc_error(0, i, "allocation failed in the concurrent replay");
+	    __atomic_store_n(&share->failed, 1, __ATOMIC_RELAXED);
+	    break;
+	}
+	hist_add(&self->hist, ticks_since(start));
+	__atomic_store_n(&share->done[i], 1, __ATOMIC_RELEASE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    self->secs = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    return NULL;
+}
+
+/*
+ * eval_concurrent - Replay a trace with one worker per trace thread,
+ *     through mm (behind a lock) or libc malloc, and print the
+ *     throughput and each thread's latency
+ *     Returns 0 if an allocation failed
+ */
+static int eval_concurrent(trace_t *trace, char *name, int libc)
+{
+    creplay_t share;
+    cworker_t *workers, *w;
+    hist_t *all;
+    latency_t lat;
+    int *last, *last_op;
+    int i, t, index, nthreads = trace->num_threads;
+    struct timespec start, end;
+    double secs;
+
+    /* Chain each thread's requests and find the cross-thread waits */
+    memset(&share, 0, sizeof(share));
+    share.trace = trace;
+    share.libc = libc;
+    if ((share.first = (int *)malloc(nthreads * sizeof(int))) == NULL
+	|| (last = (int *)malloc(nthreads * sizeof(int))) == NULL
+	|| (last_op = (int *)malloc(trace->num_ids * sizeof(int))) == NULL
+	|| (share.next = (int *)malloc(trace->num_ops * sizeof(int))) == NULL
+	|| (share.dep = (int *)malloc(trace->num_ops * sizeof(int))) == NULL
+	|| (share.done = (char *)calloc(trace->num_ops, 1)) == NULL
+	|| (workers = (cworker_t *)calloc(nthreads, sizeof(cworker_t))) == NULL
+	|| (all = (hist_t *)calloc(1, sizeof(hist_t))) == NULL)
+	unix_error("malloc failed in eval_concurrent");
+    for (t = 0; t < nthreads; t++)
+	share.first[t] = last[t] = -1;
+    for (i = 0; i < trace->num_ids; i++)
+	last_op[i] = -1;
+    for (i = 0; i < trace->num_ops; i++) {
+	t = trace->ops[i].thread;
+	index = trace->ops[i].index;
+	share.dep[i] = (last_op[index] >= 0
+			&& trace->ops[last_op[index]].thread != t)
+	    ? last_op[index] : -1;
+	last_op[index] = i;
+	share.next[i] = -1;
+	if (last[t] < 0)
+	    share.first[t] = i;
+	else
+	    share.next[last[t]] = i;
+	last[t] = i;
+    }
+    free(last);
+    free(last_op);
+
+    if (!libc && mm_init() < 0)
+	app_error("mm_init failed in eval_concurrent");
+    pthread_mutex_init(&share.mm_lock, NULL);
+    pthread_barrier_init(&share.start, NULL, nthreads + 1);
+    for (t = 0; t < nthreads; t++) {
+	workers[t].share = &share;
+	workers[t].thread = t;
+	if (pthread_create(&workers[t].tid, NULL, creplay_main, &workers[t]) != 0)
+	    unix_error("pthread_create failed in eval_concurrent");
+    }
+    pthread_barrier_wait(&share.start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < nthreads; t++)
+	pthread_join(workers[t].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+    if (!libc)
+	mem_reset();
+
+    printf("%s (%s): %d ops on %d threads in %.3f secs, %.0f Kops\n",
+	   name, libc ? "libc" : "mm", trace->num_ops, nthreads, secs,
+	   trace->num_ops / 1e3 / secs);
+    printf("%8s%10s%10s%10s%10s%12s%10s\n", "thread", "ops", "Kops",
+	   "p50 ns", "p99 ns", "max ns", "waited");
+    for (t = 0; t <= nthreads; t++) {
+	w = &workers[t < nthreads ? t : 0];
+	if (t < nthreads) {
+	    hist_summary(&w->hist, &lat);
+	    hist_merge(all, &w->hist);
+	    printf("%8d", t);
+	}
+	else {
+	    hist_summary(all, &lat);
+	    printf("%8s", "all");
+	}
+	if (lat.count == 0) {
+	    printf("%10d\n", 0);
+	    continue;
+	}
+	printf("%10ld%10.0f%10.0f%10.0f%12.0f", lat.count,
+	       lat.count / 1e3 / (t < nthreads ? w->secs : secs),
+	       lat.p50, lat.p99, lat.max);
+	if (t < nthreads)
+	    printf("%9.0f%%", 100.0 * w->waited / cyc_per_ns / 1e9 / w->secs);
+	printf("\n");
+    }
+
+    pthread_barrier_destroy(&share.start);
+    free(share.first);
+    free(share.next);
+    free(share.dep);
+    free(share.done);
+    free(workers);
+    free(all);
+    return !share.failed;
+}
+
+/*****************************************************************
+ * The following routines write the results in machine-readable
+ * form and check a run against the results of an earlier one. A
+ * JSON results file has one trace per line, which is all that
+ * read_baseline needs to find its way around one.
+ ****************************************************************/
+
+/*
+ * json_string - Write s as a JSON string
+ */
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(f, "\\%c", *s);
+	else if ((unsigned char)*s < ' ')
+	    fprintf(f, "\\u%04x", *s);
+	else
+	    fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * cpu_model - The processor's model name, or "unknown"
+ */
+static void cpu_model(char *buf, size_t len)
+{
+    FILE *f;
+    char line[MAXLINE], *p;
+
+    snprintf(buf, len, "unknown");
+    if ((f = fopen("/proc/cpuinfo", "r")) == NULL)
+	return;
+    while (fgets(line, sizeof(line), f) != NULL)
+	if (strncmp(line, "model name", 10) == 0
+	    && (p = strchr(line, ':')) != NULL) {
+	    for (p++; *p == ' '; p++)
+		;
+	    p[strcspn(p, "\n")] = '\0';
+	    snprintf(buf, len, "%s", p);
+	    break;
+	}
+    fclose(f);
+}
+
+/*
+ * json_stats - Write one allocator's results as a JSON array, one trace
+ *     per line
+ */
+static void json_stats(FILE *f, char *name, char **tracefiles, int n,
+		       stats_t *stats)
+{
+    int i;
+
+    fprintf(f, "  \"%s\": [\n", name);
+    for (i = 0; i < n; i++) {
+	fprintf(f, "    {\"trace\": ");
+	json_string(f, tracefiles[i]);
+	fprintf(f, ", \"valid\": %s, \"ops\": %.0f",
+		stats[i].valid ? "true" : "false", stats[i].ops);
+	if (stats[i].valid)
+	    fprintf(f, ", \"secs\": %.9f, \"kops\": %.3f, \"util\": %.6f, "
+		    "\"util_i\": %.6f, \"noise\": %.6f, \"secs_min\": %.9f, "
+		    "\"secs_sd\": %.9f, \"samples\": %d, \"heap_peak\": %lu, "
+		    "\"heap_mean\": %.0f, \"heap_p95\": %lu",
+		    stats[i].secs, (stats[i].ops/1e3)/stats[i].secs,
+		    stats[i].util, stats[i].inst_util, stats[i].noise,
+		    stats[i].secs_min, stats[i].secs_sd, stats[i].samples,
+		    stats[i].foot_heap, stats[i].heap_area / stats[i].ops,
+		    stats[i].heap_p95);
+	fprintf(f, "}%s\n", i < n-1 ? "," : "");
+    }
+    fprintf(f, "  ]");
+}
+
+/*
+ * csv_stats - Write one allocator's results as CSV rows
+ */
+static void csv_stats(FILE *f, char *name, char **tracefiles, int n,
+		      stats_t *stats)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	fprintf(f, "%s,%s,%d,%.0f", name, tracefiles[i], stats[i].valid,
+		stats[i].ops);
+	if (stats[i].valid)
+	    fprintf(f, ",%.9f,%.3f,%.6f,%.6f,%.6f,%.9f,%.9f,%d,%lu,%.0f,%lu\n",
+		    stats[i].secs, (stats[i].ops/1e3)/stats[i].secs,
+		    stats[i].util, stats[i].inst_util, stats[i].noise,
+		    stats[i].secs_min, stats[i].secs_sd, stats[i].samples,
+		    stats[i].foot_heap, stats[i].heap_area / stats[i].ops,
+		    stats[i].heap_p95);
+	else
+	    fprintf(f, ",,,,,,,,,,,\n");
+    }
+}
+
+/*
+ * write_results - Write the per-trace results of both allocators (libc
+ *     only if it ran), with the host and build they came from, as JSON
+ *     or CSV. CSV puts the host and build in "#" comment lines.
+ */
+static void write_results(char *path, int csv, char **tracefiles, int n,
+			  stats_t *libc_stats, stats_t *mm_stats, double perfindex)
+{
+    FILE *f;
+    struct utsname u;
+    char cpu[MAXLINE];
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((f = fopen(path, "w")) == NULL)
+	unix_error("fopen failed in write_results");
+    if (uname(&u) < 0)
+	unix_error("uname failed in write_results");
+    cpu_model(cpu, sizeof(cpu));
+
+    if (csv) {
+	fprintf(f, "# host %s, %s %s %s, %ld cpus, %s\n",
+		u.nodename, u.sysname, u.release, u.machine, ncpus, cpu);
+	fprintf(f, "# build gcc %s, %soptimized, timer %s, alignment %d\n",
+		__VERSION__,
+#ifdef __OPTIMIZE__
+		"",
+#else
+		"not ",
+#endif
+		fsecs_timer(), ALIGNMENT);
+	fprintf(f, "# perfidx %.0f\n", perfindex);
+	fprintf(f, "allocator,trace,valid,ops,secs,kops,util,util_i,noise,"
+		"secs_min,secs_sd,samples,heap_peak,heap_mean,heap_p95\n");
+	if (libc_stats != NULL)
+	    csv_stats(f, "libc", tracefiles, n, libc_stats);
+	csv_stats(f, "mm", tracefiles, n, mm_stats);
+	fclose(f);
+	return;
+    }
+
+    fprintf(f, "{\n  \"host\": {\"name\": ");
+    json_string(f, u.nodename);
+    fprintf(f, ", \"os\": \"%s %s\", \"machine\": \"%s\", \"cpus\": %ld, "
+	    "\"cpu\": ", u.sysname, u.release, u.machine, ncpus);
+    json_string(f, cpu);
+    fprintf(f, "},\n  \"build\": {\"compiler\": ");
+    json_string(f, "gcc " __VERSION__);
+#ifdef __OPTIMIZE__
+    fprintf(f, ", \"optimized\": true");
+#else
+    fprintf(f, ", \"optimized\": false");
+#endif
+    fprintf(f, ", \"timer\": \"%s\", \"alignment\": %d},\n",
+	    fsecs_timer(), ALIGNMENT);
+    fprintf(f, "  \"perfidx\": %.0f,\n", perfindex);
+    if (libc_stats != NULL) {
+	json_stats(f, "libc", tracefiles, n, libc_stats);
+	fprintf(f, ",\n");
+    }
+    json_stats(f, "mm", tracefiles, n, mm_stats);
+    fprintf(f, "\n}\n");
+    fclose(f);
+}
+
+/*
+ * json_number - The number after "key": in line, or -1 if there isn't one
+ */
+static double json_number(char *line, char *key)
+{
+    char pat[MAXLINE], *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\": ", key);
+    if ((p = strstr(line, pat)) == NULL)
+	return -1;
+    p += strlen(pat);
+    if (strncmp(p, "true", 4) == 0)
+	return 1;
+    if (strncmp(p, "false", 5) == 0)
+	return 0;
+    return strtod(p, NULL);
+}
+
+/*
+ * read_baseline - Read the mm results of a JSON file written by
+ *     --json. Returns the number of traces and sets *base to them.
+ */
+static int read_baseline(char *path, base_t **base)
+{
+    FILE *f;
+    char line[MAXLINE], *p;
+    int n = 0, in_mm = 0;
+    base_t *b;
+
+    if ((f = fopen(path, "r")) == NULL)
+	unix_error("can't open the baseline file");
+    *base = NULL;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	if (strncmp(line, "  \"mm\": [", 9) == 0) {
+	    in_mm = 1;
+	    continue;
+	}
+	if (!in_mm || (p = strstr(line, "\"trace\": \"")) == NULL) {
+	    in_mm = in_mm && strncmp(line, "  ]", 3) != 0;
+	    continue;
+	}
+	if ((*base = (base_t *)realloc(*base, (n+1) * sizeof(base_t))) == NULL)
+	    unix_error("realloc failed in read_baseline");
+	b = &(*base)[n++];
+	p += strlen("\"trace\": \"");
+	snprintf(b->trace, sizeof(b->trace), "%.*s", (int)strcspn(p, "\""), p);
+	b->valid = json_number(line, "valid") == 1;
+	b->ops = json_number(line, "ops");
+	b->secs = json_number(line, "secs_min");
+	if (b->secs <= 0)
+	    b->secs = json_number(line, "secs");
+	b->util = json_number(line, "util");
+    }
+    fclose(f);
+    if (n == 0)
+	app_error("no mm results in the baseline file");
+    return n;
+}
+
+/*
+ * check_baseline - Compare mm's results with those in a baseline file
+ *     and print how each trace fared. Kops comes from each run's
+ *     fastest sample, which moves far less between runs than the
+ *     median does. A trace regresses if it is no longer valid or if
+ *     its util drops by more than util_tolerance points; a single
+ *     trace's Kops is too noisy to fail on, so a drop of more than
+ *     thru_tolerance percent there is only flagged, and it is the
+ *     total Kops that must stay within it. Returns the number of
+ *     regressions.
+ */
+static int check_baseline(char *path, char **tracefiles, int n, stats_t *stats)
+{
+    base_t *base, *b;
+    int i, j, nbase, bad = 0, matched = 0;
+    double kops, base_kops, change;
+    double ops = 0, secs = 0, util = 0;
+    double base_ops = 0, base_secs = 0, base_util = 0;
+    char *verdict;
+
+    nbase = read_baseline(path, &base);
+    printf("Against baseline %s (tolerance %.1f%% Kops, %.1f points util):\n",
+	   path, thru_tolerance, util_tolerance);
+    printf("%5s%10s%10s%9s%7s%7s  %s\n", "trace",
+	   "Kops", "base", "change", "util", "base", "");
+    for (i = 0; i < n; i++) {
+	for (j = 0, b = NULL; j < nbase && b == NULL; j++)
+	    if (strcmp(base[j].trace, tracefiles[i]) == 0)
+		b = &base[j];
+	if (b == NULL || !b->valid) {
+	    printf("%2d%13s%10s%9s%7s%7s  %s\n",
+		   i, "-", "-", "-", "-", "-", "not in baseline");
+	    continue;
+	}
+	if (!stats[i].valid) {
+	    printf("%2d%13s%10.0f%9s%7s%6.0f%%  %s\n",
+		   i, "-", (b->ops/1e3)/b->secs, "-", "-",
+		   b->util*100.0, "REGRESSED (invalid)");
+	    bad++;
+	    continue;
+	}
+	kops = (stats[i].ops/1e3)/stats[i].secs_min;
+	base_kops = (b->ops/1e3)/b->secs;
+	change = (kops/base_kops - 1.0)*100.0;
+	verdict = "ok";
+	if ((b->util - stats[i].util)*100.0 > util_tolerance) {
+	    verdict = "REGRESSED";
+	    bad++;
+	}
+	else if (change < -thru_tolerance)
+	    verdict = "slower";
+	printf("%2d%13.0f%10.0f%+8.1f%%%6.0f%%%6.0f%%  %s\n",
+	       i, kops, base_kops, change,
+	       stats[i].util*100.0, b->util*100.0, verdict);
+	matched++;
+	ops += stats[i].ops;
+	secs += stats[i].secs_min;
+	util += stats[i].util;
+	base_ops += b->ops;
+	base_secs += b->secs;
+	base_util += b->util;
+    }
+
+    /* The totals, over the traces that both runs have */
+    if (matched > 0) {
+	kops = (ops/1e3)/secs;
+	base_kops = (base_ops/1e3)/base_secs;
+	change = (kops/base_kops - 1.0)*100.0;
+	verdict = "ok";
+	if (change < -thru_tolerance
+	    || (base_util - util)/matched*100.0 > util_tolerance) {
+	    verdict = "REGRESSED";
+	    bad++;
+	}
+	printf("%5s%10.0f%10.0f%+8.1f%%%6.0f%%%6.0f%%  %s\n",
+	       "Total", kops, base_kops, change,
+	       util/matched*100.0, base_util/matched*100.0, verdict);
+    }
+    printf("\n");
+    free(base);
+    return bad;
+}
+
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -982,6 +4993,328 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printspace - prints the utilization and peak heap of mm and libc
+ *    malloc side by side
+ */
+static void printspace(int n, stats_t *libc_stats, stats_t *mm_stats)
+{
+    int i;
+
+    printf("%5s%12s%7s%14s%7s%14s%14s\n", "trace", "util", "", "util_i", "",
+	   "peak heap", "");
+    for (i = 0; i < n; i++) {
+	printf("%2d", i);
+	if (mm_stats[i].valid)
+	    printf("%9.0f%%", mm_stats[i].util*100.0);
+	else
+	    printf("%10s", "-");
+	if (libc_stats[i].valid)
+	    printf("%6.0f%%", libc_stats[i].util*100.0);
+	else
+	    printf("%7s", "-");
+	if (mm_stats[i].valid)
+	    printf("%13.0f%%", mm_stats[i].inst_util*100.0);
+	else
+	    printf("%14s", "-");
+	if (libc_stats[i].valid)
+	    printf("%6.0f%%", libc_stats[i].inst_util*100.0);
+	else
+	    printf("%7s", "-");
+	if (mm_stats[i].valid)
+	    printf("%14lu", mm_stats[i].foot_heap);
+	else
+	    printf("%14s", "-");
+	if (libc_stats[i].valid)
+	    printf("%14lu", libc_stats[i].foot_heap);
+	else
+	    printf("%14s", "-");
+	printf("\n");
+    }
+}
+
+/*
+ * printfootprint - prints how the heap was used at its largest, as a
+ *    percentage of the mapped bytes
+ */
+static void printfootprint(int n, stats_t *stats)
+{
+    int i;
+    double heap;
+
+    printf("%5s%12s%9s%8s%8s%8s%8s\n",
+	   "trace", "heap", "payload", "slack", "header", "free", "chunk");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].foot_heap) {
+	    heap = stats[i].foot_heap / 100.0;
+	    printf("%2d%15lu%8.1f%%%7.1f%%%7.1f%%%7.1f%%%7.1f%%\n",
+		   i,
+		   stats[i].foot_heap,
+		   stats[i].foot_payload / heap,
+		   stats[i].foot_slack / heap,
+		   stats[i].foot_header / heap,
+		   stats[i].foot_free / heap,
+		   stats[i].foot_chunk / heap);
+	}
+	else
+	    printf("%2d%15s%9s%8s%8s%8s%8s\n",
+		   i, "-", "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printsustained - prints the footprint each trace kept up: its mean
+ *    and 95th percentile over the ops next to the peak, and the ratio
+ *    of the areas under the live and heap curves
+ */
+static void printsustained(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%12s%12s%12s%12s%8s\n",
+	   "trace", "peak heap", "mean heap", "p95 heap", "mean live", "util_t");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].heap_area > 0)
+	    printf("%2d%15lu%12.0f%12lu%12.0f%7.0f%%\n",
+		   i,
+		   stats[i].foot_heap,
+		   stats[i].heap_area / stats[i].ops,
+		   stats[i].heap_p95,
+		   stats[i].live_area / stats[i].ops,
+		   stats[i].live_area / stats[i].heap_area * 100.0);
+	else
+	    printf("%2d%15s%12s%12s%12s%8s\n", i, "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printtouch - prints the time each trace took with its blocks touched,
+ *    split between the allocator and the touching, next to the time
+ *    it took without
+ */
+static void printtouch(int n, stats_t *stats)
+{
+    int i;
+    double alloc;
+
+    printf("%5s%10s%10s%10s%10s%8s\n",
+	   "trace", "untouched", "total", "touch", "alloc", "touch%");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    alloc = stats[i].touch_secs - stats[i].touch_part;
+	    printf("%2d%13.4f%10.4f%10.4f%10.4f%7.1f%%\n", i,
+		   stats[i].secs*1e3, stats[i].touch_secs*1e3,
+		   stats[i].touch_part*1e3, alloc*1e3,
+		   stats[i].touch_part / stats[i].touch_secs * 100.0);
+	}
+	else
+	    printf("%2d%13s%10s%10s%10s%8s\n", i, "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printtrim - prints the footprint before and after each trace's mm_trim
+ */
+static void printtrim(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%12s%12s%12s%12s%12s\n",
+	   "trace", "heap", "heap'", "rss", "rss'", "released");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%15lu%12lu%12lu%12lu%12lu\n",
+		   i,
+		   stats[i].trim_heap[0],
+		   stats[i].trim_heap[1],
+		   stats[i].trim_rss[0],
+		   stats[i].trim_rss[1],
+		   stats[i].trim_released);
+	else
+	    printf("%2d%15s%12s%12s%12s%12s\n",
+		   i, "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printfaults - prints the page faults each timed run of a trace took
+ */
+static void printfaults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s", "trace", "minor", "major");
+    if (reserve_bytes)
+	printf("%14s", "reserve msecs");
+    printf("\n");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%13.0f%10.0f", i, stats[i].minflt, stats[i].majflt);
+	else
+	    printf("%2d%13s%10s", i, "-", "-");
+	if (reserve_bytes && stats[i].valid)
+	    printf("%14.3f", stats[i].reserve_secs * 1e3);
+	printf("\n");
+    }
+}
+
+/*
+ * printlimit - prints the peak footprint of each trace and how often it
+ *    ran out of memory under the address-space limit
+ */
+static void printlimit(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%12s%10s\n", "trace", " valid", "peak heap", "reclaims");
+    for (i=0; i < n; i++)
+	printf("%2d%10s%12lu%10d\n",
+	       i,
+	       stats[i].valid ? "yes" : "no",
+	       stats[i].peak_heap,
+	       stats[i].reclaims);
+}
+
+/*
+ * printlatency - prints per-op latency percentiles and the peak heap
+ *    with the background thread off and on
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i;
+    latency_t *off, *on;
+
+    printf("%5s%8s%8s%8s%9s%10s |%8s%8s%8s%9s%10s\n", "trace",
+	   "p50", "p99", "p99.9", "max", "heap",
+	   "p50", "p99", "p99.9", "max", "heap");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    off = &stats[i].lat[0];
+	    on = &stats[i].lat[1];
+	    printf("%2d%11.0f%8.0f%8.0f%9.0f%10lu |%8.0f%8.0f%8.0f%9.0f%10lu\n",
+		   i, off->p50, off->p99, off->p999, off->max, off->peak_heap,
+		   on->p50, on->p99, on->p999, on->max, on->peak_heap);
+	}
+	else
+	    printf("%2d%11s%8s%8s%9s%10s |%8s%8s%8s%9s%10s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printoplatency - prints per-op latency percentiles by op type and
+ *    request size, then over all ops, for each trace
+ */
+static void printoplatency(int n, stats_t *stats)
+{
+    static char *ops[LAT_OPS] = {"malloc", "free", "realloc"};
+    static char *sizes[LAT_SIZES] = {"<=64", "<=512", "<=4K", "<=32K", ">32K"};
+    int i, op, sz;
+    latency_t *lat;
+
+    printf("%5s%9s%7s%9s%8s%8s%8s%9s\n", "trace",
+	   "op", "size", "count", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%7s%9s%8s%8s%8s%9s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (op = 0; op < LAT_OPS; op++)
+	    for (sz = 0; sz < LAT_SIZES; sz++) {
+		lat = &stats[i].oplat[op][sz];
+		if (lat->count > 0)
+		    printf("%2d%12s%7s%9ld%8.0f%8.0f%8.0f%9.0f\n", i,
+			   ops[op], sizes[sz], lat->count,
+			   lat->p50, lat->p99, lat->p999, lat->max);
+	    }
+	lat = &stats[i].alllat;
+	printf("%2d%12s%7s%9ld%8.0f%8.0f%8.0f%9.0f\n", i,
+	       "all", "", lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+    }
+}
+
+/*
+ * printtiming - prints the median, fastest and spread of each trace's
+ *    timed samples
+ */
+static void printtiming(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%9s%10s%10s%10s%10s\n",
+	   "trace", "samples", "median", "min", "stddev", "95% CI");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%12d%10.4f%10.4f%10.4f%9.1f%%\n", i,
+		   stats[i].samples, stats[i].secs*1e3, stats[i].secs_min*1e3,
+		   stats[i].secs_sd*1e3, stats[i].noise*100.0);
+	else
+	    printf("%2d%12s%10s%10s%10s%10s\n", i, "-", "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printcounters - prints the hardware events per op of each trace
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    static int cols[] = {PC_L1D, PC_LLC, PC_DTLB, PC_BRANCH};
+    int i, j;
+    double *ctr;
+
+    printf("%5s%10s%9s%6s%9s%9s%9s%9s\n", "trace", "instrs", "cycles",
+	   "IPC", "L1d miss", "LLC miss", "dTLB mis", "br miss");
+    for (i=0; i < n; i++) {
+	ctr = stats[i].ctr;
+	if (!stats[i].valid) {
+	    printf("%2d%13s%9s%6s%9s%9s%9s%9s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d", i);
+	if (ctr[PC_INSTRS] >= 0)
+	    printf("%13.1f", ctr[PC_INSTRS]);
+	else
+	    printf("%13s", "-");
+	if (ctr[PC_CYCLES] >= 0)
+	    printf("%9.1f", ctr[PC_CYCLES]);
+	else
+	    printf("%9s", "-");
+	if (ctr[PC_INSTRS] >= 0 && ctr[PC_CYCLES] > 0)
+	    printf("%6.2f", ctr[PC_INSTRS] / ctr[PC_CYCLES]);
+	else
+	    printf("%6s", "-");
+	for (j = 0; j < sizeof(cols)/sizeof(cols[0]); j++)
+	    if (ctr[cols[j]] >= 0)
+		printf("%9.3f", ctr[cols[j]]);
+	    else
+		printf("%9s", "-");
+	printf("\n");
+    }
+}
+
+/*
+ * printprof - prints throughput with and without the heap profiler
+ */
+static void printprof(int n, stats_t *stats)
+{
+    int i;
+    double kops, prof_kops;
+
+    printf("%5s%10s%10s%10s\n", "trace", "Kops", "Kops'", "overhead");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    kops = (stats[i].ops/1e3)/stats[i].secs;
+	    prof_kops = (stats[i].ops/1e3)/stats[i].prof_secs;
+	    printf("%2d%13.0f%10.0f%9.1f%%\n",
+		   i, kops, prof_kops, (kops/prof_kops - 1.0)*100.0);
+	}
+	else
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1003,10 +5336,30 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, long opnum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, line %ld]: %s\n", tracenum, LINENUM(opnum), msg);
+}
+
+/*
+ * opt_count - Parse the value arg of option opt as a whole number from
+ *     min to max, exiting with the usage message if it isn't one
+ */
+static size_t opt_count(char *opt, char *arg, size_t min, size_t max)
+{
+    char *end;
+    unsigned long long v;
+
+    errno = 0;
+    v = strtoull(arg, &end, 0);
+    if (*arg < '0' || *arg > '9' || *end != '\0' || errno != 0
+	|| v < min || v > max) {
+	fprintf(stderr, "Bad value %s for %s\n", arg, opt);
+	usage();
+	exit(1);
+    }
+    return v;
 }
 
 /* 
@@ -1014,13 +5367,49 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaClLTB] [--json <file>] [--csv <file>] [--baseline <file>] [--tolerance <pct>] [--util-tolerance <pts>] [--timer <name>] [--warmup <n>] [--samples <min>[,<max>]] [--ci <pct>] [--cpu <n>] [--timeline <n>] [--timeline-bin <n>] [--touch <n>] [--touch-every <n>] [--generate <spec>] [--sweep <lo>,<hi>] [--concurrent] [--analyze] [-f <file>] [-F <file>] [-j <n>] [-t <dir>] [-P <n>] [-M <n>] [-R <n>] [-S <n>|peak] [-X <n>]\n");
     fprintf(stderr, "Options\n");
-    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-B         Compare per-op latency with mm's background thread.\n");
+    fprintf(stderr, "\t-C         Count hardware events per op (instructions, cycles, misses).\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file (text or binary).\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-op latency percentiles by op type and size.\n");
+    fprintf(stderr, "\t-M <n>     Allow mm only n more bytes of address space.\n");
+    fprintf(stderr, "\t-P <n>     Sample every ~n bytes with the heap profiler.\n");
+    fprintf(stderr, "\t-R <n>     mm_reserve n prefaulted bytes before each timed run.\n");
+    fprintf(stderr, "\t-F <file>  Stream <file> (- for stdin) through mm in bounded memory.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once, one process and CPU each.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Call mm_trim(0) at each trace's live peak.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-S <n>     Snapshot the heap after op n (or \"peak\") to mdriver-heap.<trace>.snap.\n");
+    fprintf(stderr, "\t-X <n>     Run the false-sharing benchmark with n threads.\n");
+    fprintf(stderr, "\t--json <file>     Write per-trace results, host and build to <file> as JSON.\n");
+    fprintf(stderr, "\t--csv <file>      Write per-trace results to <file> as CSV.\n");
+    fprintf(stderr, "\t--baseline <file> Exit 1 if mm does worse than the --json results in <file>.\n");
+    fprintf(stderr, "\t--tolerance <pct> Total Kops drop --baseline allows (default 5).\n");
+    fprintf(stderr, "\t--util-tolerance <pts> Util drop --baseline allows (default 0.5).\n");
+    fprintf(stderr, "\t--timer <name>    Time with gettod, itimer, fcyc, clock or cycles (default %s).\n", DEFAULT_TIMER);
+    fprintf(stderr, "\t--warmup <n>      Untimed runs of each trace before sampling (default 1).\n");
+    fprintf(stderr, "\t--samples <min>[,<max>] Timed samples per trace (default 10,30).\n");
+    fprintf(stderr, "\t--ci <pct>        Sample until the 95%% CI is within pct%% of the mean (default 2).\n");
+    fprintf(stderr, "\t--cpu <n>         Pin mdriver to the nth CPU it may run on.\n");
+    fprintf(stderr, "\t--timeline <n>    Write the footprint every nth op to mdriver-timeline.<trace>.csv.\n");
+    fprintf(stderr, "\t--timeline-bin <n> Same, in binary to mdriver-timeline.<trace>.bin.\n");
+    fprintf(stderr, "\t--touch <n>       Also time each trace writing and reading n bytes of each block.\n");
+    fprintf(stderr, "\t--touch-every <n> ... and reading all live blocks every n ops.\n");
+    fprintf(stderr, "\t--generate <spec> Stream a synthetic trace through mm, as -F does. <spec> is\n");
+    fprintf(stderr, "\t                  key=value,... from ops=<n> live=<bytes> seed=<n> long=<frac>\n");
+    fprintf(stderr, "\t                  life=exp|lifo|fifo size=uniform:lo:hi|lognormal:median:sigma|\n");
+    fprintf(stderr, "\t                  zipf:s:classes|bimodal:small:large:p\n");
+    fprintf(stderr, "\t--sweep <lo>,<hi> Time the --generate model at live sets doubling from lo to\n");
+    fprintf(stderr, "\t                  hi blocks; exit 1 if time or heap grows super-linearly.\n");
+    fprintf(stderr, "\t--concurrent      Replay each trace with a thread per thread in its thread\n");
+    fprintf(stderr, "\t                  column, through mm behind a lock (and libc with -l).\n");
+    fprintf(stderr, "\t--analyze         Profile the -F or --generate trace instead of replaying it:\n");
+    fprintf(stderr, "\t                  sizes, lifetimes, live peak, realloc growth, LIFO frees.\n");
+    fprintf(stderr, "\t                  With --json <file>, also write the profile there.\n");
 }
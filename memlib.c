@@ -16,7 +16,9 @@
 /* private variables */
 static int activity_counter = 0; /* to simulate other processes */
 
-static int page_count;
+static size_t page_count;
+static size_t peak_page_count;
+static size_t resident_count;
 
 /* 
  * mem_init - initialize the memory system model
@@ -60,11 +62,27 @@ size_t mem_pagesize()
 
 size_t mem_heapsize(void)
 {
-  return APAGE_SIZE * page_count;
+  return (size_t)APAGE_SIZE * page_count;
 }
 
+/*
+ * mem_peakheapsize - the largest mem_heapsize() since the last call to
+ *   mem_resetpeak(), surviving any mem_reset() in between
+ */
+size_t mem_peakheapsize(void)
+{
+  return (size_t)APAGE_SIZE * peak_page_count;
+}
 
-void *mem_map(size_t sz)
+void mem_resetpeak(void)
+{
+  peak_page_count = page_count;
+}
+
+/*
+ * map_pages - map sz bytes of fresh pages, passing extra flags to mmap
+ */
+static void *map_pages(size_t sz, int flags)
 {
   void *p;
   size_t i;
@@ -75,28 +93,55 @@ void *mem_map(size_t sz)
     abort();
   }
 
+#ifndef MEMLIB_DIRECT
   activity_counter++;
   if ((activity_counter & (activity_counter - 1)) == 0) {
     /* allocate a page to ensure that mem_map results are not
        always sequential */
     mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
   }
+#endif
 
-  p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (p == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %s (%d)\n",
-            strerror(errno), errno);
-    abort();
-  }
+  p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | flags, -1, 0);
+  if (p == MAP_FAILED)
+    return (void *)-1;
 
   for (i = 0; i < sz; i += APAGE_SIZE) {
-    pagemap_modify(p + i, 1);
+    if (pagemap_modify(p + i, 1) < 0) {
+      /* out of memory for the page map itself: undo and fail */
+      while (i > 0) {
+        i -= APAGE_SIZE;
+        pagemap_modify(p + i, 0);
+        page_count--;
+      }
+      munmap(p, sz);
+      return (void *)-1;
+    }
     page_count++;
   }
+  if (page_count > peak_page_count)
+    peak_page_count = page_count;
   
   return p;
 }
 
+/*
+ * mem_map - map sz bytes of fresh pages
+ *   Returns (void *)-1 when the OS has no memory to give
+ */
+void *mem_map(size_t sz)
+{
+  return map_pages(sz, 0);
+}
+
+/*
+ * mem_map_populate - like mem_map, but the pages are faulted in up front
+ */
+void *mem_map_populate(size_t sz)
+{
+  return map_pages(sz, MAP_POPULATE);
+}
+
 void mem_unmap(void *p, size_t sz)
 {
   size_t i;
@@ -131,3 +176,57 @@ void mem_unmap(void *p, size_t sz)
     abort();
   }
 }
+
+/*
+ * mem_purge - give the physical pages behind a mapped range back to the
+ *   OS without unmapping it; the range reads as zeros when touched again
+ */
+void mem_purge(void *p, size_t sz)
+{
+  size_t i;
+
+  if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_purge: given address is not page-aligned: %p\n",
+            p);
+    abort();
+  }
+
+  if (sz & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_purge: given size is not a multiple of %d: %ld\n",
+            APAGE_SIZE, sz);
+    abort();
+  }
+
+  for (i = 0; i < sz; i += APAGE_SIZE) {
+    if (!pagemap_is_mapped(p+i)) {
+      fprintf(stderr, "mem_purge: given page is not mapped: %p (in %p:%p)\n",
+              p + i, p, p + sz);
+      abort();
+    }
+  }
+
+  if (madvise(p, sz, MADV_DONTNEED) < 0) {
+    fprintf(stderr, "madvise failed: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
+  }
+}
+
+static void count_resident(void *p)
+{
+  unsigned char vec;
+
+  if (mincore(p, APAGE_SIZE, &vec) == 0 && (vec & 1))
+    resident_count++;
+}
+
+/*
+ * mem_residentsize - bytes of mapped pages that are currently backed by
+ *   physical memory
+ */
+size_t mem_residentsize(void)
+{
+  resident_count = 0;
+  pagemap_walk(count_resident);
+  return (size_t)APAGE_SIZE * resident_count;
+}
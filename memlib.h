@@ -5,6 +5,11 @@ void mem_reset(void);
 
 size_t mem_pagesize(void);
 void *mem_map(size_t);
+void *mem_map_populate(size_t);
 void mem_unmap(void *, size_t);
+void mem_purge(void *, size_t);
 
 size_t mem_heapsize(void);
+size_t mem_peakheapsize(void);
+void mem_resetpeak(void);
+size_t mem_residentsize(void);
@@ -14,6 +14,13 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -32,13 +39,75 @@ typedef size_t block_header;
 typedef size_t block_footer;
 #define OVERHEAD   (sizeof(block_header) + sizeof(block_footer))
 #define INIT_SIZE  (1<<6)
+#define LINE_SIZE  64  // cache line size
+#define SNAP_BUF   512  // words mm_snapshot buffers per write
+#define PROF_BUF   4096 // bytes mm_profile_dump buffers per write
+#define LINE_ALIGN(size)  (((size) + (LINE_SIZE-1)) & ~(LINE_SIZE-1))
 #define MAX(x, y)  ((x) > (y) ? (x) : (y))
 #define MIN(x, y)  ((x) < (y) ? (x) : (y))
 void *first_free = NULL;
 
+// Every chunk from mem_map is described by a chunk_t that lives in the
+// payload of its sentinel block, so all chunks can be walked in a list
+typedef struct chunk_t {
+  struct chunk_t *next;  // next chunk in the chunk list
+  struct chunk_t *prev;  // previous chunk in the chunk list
+} chunk_t;
+chunk_t *first_chunk = NULL;
+
+// Background maintenance: while bg_running, heap_lock guards the heap,
+// mm_free only queues its block, and empty chunks are left for the
+// background thread to unmap
+#define BG_QUEUE     4096     // deferred frees the queue can hold
+#define BG_BATCH     64       // frees done per hold of heap_lock
+#define BG_INLINE    8        // queued frees mm_malloc does before extending
+#define BG_BACKLOG   256      // ... or all of them, once this many wait
+#define BG_PENDING   256      // empty chunks waiting to be unmapped
+#define BG_PURGE_MIN (1<<18)  // free blocks the thread purges right away
+static volatile int bg_running = 0;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static chunk_t *pending_chunks[BG_PENDING];
+static int num_pending = 0;
+static void forget_pending(chunk_t *chunk);
+static void bg_kick(void);
+static int bg_defer(void *ptr);
+static int drain_deferred(int max);
+static size_t bg_queued(void);
+
+// Cache-line placement: blocks that get it start on a line boundary and
+// their payload fills whole lines, so no neighbour shares them
+static int line_mode = 0;       // line_min or line_threads is set
+static size_t line_min = 0;     // requests at least this big get lines
+static int line_threads = 0;    // every request once threads mix
+static int line_seen = 0, line_multi = 0;
+static pthread_t line_first;    // first thread to call mm_malloc
+
+// Application hook for shedding memory when mem_map fails
+static mm_reclaim_fn reclaim_fn = NULL;
+static void *reclaim_arg = NULL;
+
+#define HEAP_LOCK()    do { if (bg_running) pthread_mutex_lock(&heap_lock); } while (0)
+#define HEAP_UNLOCK()  do { if (bg_running) pthread_mutex_unlock(&heap_lock); } while (0)
+
+// Sentinel block size, and the bytes of each chunk not usable for blocks
+// (8 bytes of padding, the sentinel and the terminator)
+#define SENTINEL_SIZE   ALIGN(sizeof(chunk_t) + OVERHEAD)
+#define CHUNK_OVERHEAD  (sizeof(block_header) + SENTINEL_SIZE + \
+                         sizeof(block_header))
+
 // Combine a size and alloc bit
 #define PACK(size, alloc)  ((size) | (alloc))
 
+// Extra header bits: a chunk's sentinel block, and a free block whose
+// interior pages have already been returned with mem_purge()
+#define SENTINEL_BIT  0x2
+#define PURGED_BIT    0x4
+#define SAMPLED_BIT   0x8  // allocated block tracked by the heap profiler
+
+// On a chunk's sentinel the purged/sampled bits are free to mean:
+#define PENDING_BIT   0x4  // empty chunk queued for the background thread
+#define RESERVED_BIT  0x8  // chunk from mm_reserve, never given back
+
 // Get address of header/footer of ptr block
 #define HDRP(ptr)  ((char *)(ptr) - sizeof(block_header))
 #define FTRP(ptr)  ((char *)(ptr) + GET_SIZE(HDRP(ptr)) - OVERHEAD)
@@ -50,6 +119,8 @@ void *first_free = NULL;
 // Get size and allocation bit of ptr block
 #define GET_SIZE(ptr)   (GET(ptr) & ~0xF)
 #define GET_ALLOC(ptr)  (GET(ptr) & 0x1)
+#define GET_SENTINEL(ptr)  (GET(ptr) & SENTINEL_BIT)
+#define GET_PURGED(ptr)    (GET(ptr) & PURGED_BIT)
 
 // Address of adjacent blocks
 #define NEXT_BLKP(ptr)  ((char *)(ptr) + GET_SIZE(HDRP(ptr)))
@@ -61,6 +132,14 @@ void *first_free = NULL;
 #define F_PREV_PTR(ptr)  ((char *)(ptr))
 #define F_NEXT_PTR(ptr)  ((char *)(ptr) + sizeof(block_header))
 #define F_SET_PTR(p, ptr)  (*(size_t *)(p) = (size_t)(ptr))
+
+// Chunk record of a mapped chunk, first block of a chunk, and chunk base
+#define CHUNK_OF(base)     ((chunk_t *)((char *)(base) + OVERHEAD))
+#define CHUNK_FIRST(c)     ((char *)(c) + SENTINEL_SIZE)
+#define CHUNK_BASE(c)      ((char *)(c) - OVERHEAD)
+
+// Size of a chunk whose blocks have all coalesced into its first block
+#define CHUNK_SIZE(c)      (GET_SIZE(HDRP(CHUNK_FIRST(c))) + CHUNK_OVERHEAD)
 /********** End of my macros and variables **********/
 
 
@@ -163,30 +242,38 @@ static void *set_allocated(void *ptr, size_t asize) {
 }
 
 /*
- * Request more memory by calling mem_map
+ * Request more memory by calling mem_map (or the given variant of it)
  * Initialize the new chunk of memory as applicable
- *  - 8 bytes of padding needed at the start of every page
- *  - Use a sentinel block (header+footer) at the start of every page
- *  - Add a terminator block (header) at the end of every page
+ *  - 8 bytes of padding needed at the start of every chunk
+ *  - Use a sentinel block at the start of every chunk, whose payload
+ *    holds the chunk_t that links the chunk into the chunk list
+ *  - Add a terminator block (header) at the end of every chunk
  * Update free list if applicable
  */
-static void *extend(size_t asize) {
+static void *extend_with(size_t asize, void *(*map)(size_t)) {
 //  printf("extend called\n - Requesting %ld bytes\n", asize);
   void *ptr;
+  chunk_t *chunk;
 
-  if ((long)(ptr = mem_map(asize)) == -1)
+  if ((long)(ptr = map(asize)) == -1)
     return NULL;
 
 //  printf(" - Base address of new chunk: %p\n", ptr);
 
-  // After 8 bytes of padding, set sentinel block of size OVERHEAD as allocated
-  PUT(HDRP(ptr+OVERHEAD), PACK(OVERHEAD, 1));
-  PUT(FTRP(ptr+OVERHEAD), PACK(OVERHEAD, 1));
-  // Add terminator at end of page
+  // After 8 bytes of padding, set sentinel block as allocated
+  chunk = CHUNK_OF(ptr);
+  PUT(HDRP(chunk), PACK(SENTINEL_SIZE, 1 | SENTINEL_BIT));
+  PUT(FTRP(chunk), PACK(SENTINEL_SIZE, 1 | SENTINEL_BIT));
+  chunk->prev = NULL;
+  chunk->next = first_chunk;
+  if (first_chunk != NULL)
+    first_chunk->prev = chunk;
+  first_chunk = chunk;
+  // Add terminator at end of chunk
   PUT(HDRP(ptr+asize), PACK(0, 1));
-  // Add a free block spanning the middle of the page
-  ptr += OVERHEAD * 2;
-  asize -= OVERHEAD * 2;
+  // Add a free block spanning the middle of the chunk
+  ptr = CHUNK_FIRST(chunk);
+  asize -= CHUNK_OVERHEAD;
   PUT(HDRP(ptr), PACK(asize, 0));
   PUT(FTRP(ptr), PACK(asize, 0));
 
@@ -194,32 +281,83 @@ static void *extend(size_t asize) {
   return ptr;
 }
 
+static void *extend(size_t asize) {
+  return extend_with(asize, mem_map);
+}
+
+/*
+ * Unlink an entirely free chunk and give it back with mem_unmap
+ * Returns the number of bytes unmapped
+ */
+static size_t release_chunk(chunk_t *chunk) {
+  size_t size = CHUNK_SIZE(chunk);
+  if (GET(HDRP(chunk)) & PENDING_BIT)
+    forget_pending(chunk);
+  delete_node(CHUNK_FIRST(chunk));
+  if (chunk->prev != NULL)
+    chunk->prev->next = chunk->next;
+  else
+    first_chunk = chunk->next;
+  if (chunk->next != NULL)
+    chunk->next->prev = chunk->prev;
+//  printf(" - Freeing a chunk of %ld bytes at %p\n", size, chunk);
+  mem_unmap(CHUNK_BASE(chunk), size);
+  return size;
+}
+
 /*
  * Check to see if a whole chunk is now free.
  * Should be called after coalesce() does its work.
- * The chunk is empty if the left and right neighbors are sentinels.
+ * The chunk is empty if the left and right neighbors are the sentinel
+ * and the terminator. Unless the background thread is the caller, an
+ * empty chunk is queued for it instead of being unmapped here.
  */
-static void *check_chunk(void *ptr) {
+static void *check_chunk(void *ptr, int deferred) {
 //  printf("check_chunk called\n");
   if (ptr == NULL)
     return NULL;
-  size_t prev_size = GET_SIZE(HDRP(PREV_BLKP(ptr)));
+  size_t prev_sentinel = GET_SENTINEL(HDRP(PREV_BLKP(ptr)));
   size_t next_size = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
 //  printf(" - Previous block: %ld bytes, Next block: %ld bytes\n",
 //         prev_size, next_size);
 
-  if (prev_size == OVERHEAD && next_size == 0) {  // Free the chunk
-    delete_node(ptr);
-    size_t size = GET_SIZE(HDRP(ptr)) + OVERHEAD * 2;
-    ptr -= OVERHEAD * 2;
-//    printf(" - Freeing a chunk of %ld bytes at %p\n", size, ptr);
-    mem_unmap(ptr, size);
+  if (prev_sentinel && next_size == 0) {  // Free the chunk
+    chunk_t *chunk = (chunk_t *)PREV_BLKP(ptr);
+    if (GET(HDRP(chunk)) & RESERVED_BIT)
+      return ptr;
+    if (bg_running && !deferred && num_pending < BG_PENDING) {
+      if (!(GET(HDRP(chunk)) & PENDING_BIT)) {
+        PUT(HDRP(chunk), GET(HDRP(chunk)) | PENDING_BIT);
+        pending_chunks[num_pending++] = chunk;
+        bg_kick();
+      }
+      return ptr;
+    }
+    release_chunk(chunk);
     ptr = NULL;
   }
 
   return ptr;
 }
 
+/*
+ * Return the whole pages inside a free block with mem_purge, leaving its
+ * header, free-list links and footer in place.
+ * Returns the number of bytes purged
+ */
+static size_t purge_block(void *ptr) {
+  size_t size = GET_SIZE(HDRP(ptr));
+  size_t lo = PAGE_ALIGN((size_t)F_NEXT_PTR(ptr) + sizeof(char *));
+  size_t hi = (size_t)FTRP(ptr) & ~(mem_pagesize()-1);
+
+  if (GET_PURGED(HDRP(ptr)) || hi <= lo)
+    return 0;
+  mem_purge((void *)lo, hi - lo);
+  PUT(HDRP(ptr), PACK(size, PURGED_BIT));
+  PUT(FTRP(ptr), PACK(size, PURGED_BIT));
+  return hi - lo;
+}
+
 /*
  * Coalesce a free block if applicable
  * Returns pointer to new coalesced block
@@ -274,33 +412,90 @@ static void *coalesce(void *ptr) {
   insert_node(ptr, size);
   return ptr;
 }
-/********** End of helper functions **********/
-
-/* =
- * mm_init - initialize the malloc package.
+/*
+ * Release free memory until at most keep_bytes of it is left (mm_trim
+ * without the locking)
+ * Returns the number of bytes released
  */
-int mm_init(void)
-{
-//  printf("\nmm_init called\n");
-  first_free = NULL;
-  return 0;
+static size_t trim_heap(size_t keep_bytes) {
+  chunk_t *chunk, *next;
+  size_t kept = 0, released = 0;
+  void *ptr;
+
+  // Unmap whole chunks (reserved ones stay, prefaulted)
+  for (chunk = first_chunk; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    ptr = CHUNK_FIRST(chunk);
+    if (GET(HDRP(chunk)) & RESERVED_BIT)
+      continue;
+    if (GET_ALLOC(HDRP(ptr)) || GET_SIZE(HDRP(NEXT_BLKP(ptr))) != 0)
+      continue;
+    if (kept + CHUNK_SIZE(chunk) <= keep_bytes)
+      kept += CHUNK_SIZE(chunk);
+    else
+      released += release_chunk(chunk);
+  }
+
+  // Purge free page runs in the chunks that are left
+  for (chunk = first_chunk; chunk != NULL; chunk = chunk->next) {
+    if (GET(HDRP(chunk)) & RESERVED_BIT)
+      continue;
+    for (ptr = CHUNK_FIRST(chunk); GET_SIZE(HDRP(ptr)) != 0;
+         ptr = NEXT_BLKP(ptr)) {
+      if (GET_ALLOC(HDRP(ptr)))
+        continue;
+      if (kept + GET_SIZE(HDRP(ptr)) <= keep_bytes)
+        kept += GET_SIZE(HDRP(ptr));
+      else
+        released += purge_block(ptr);
+    }
+  }
+
+  return released;
 }
 
 /*
- * mm_malloc - Allocate a block by using bytes from current_avail,
- *     grabbing a new page if necessary.
+ * Split off the bytes in front of free block ptr so that what is left
+ * has its payload on an align-byte boundary. The front part stays free.
+ * Returns the aligned free block, or NULL if asize bytes won't fit then
  */
-void *mm_malloc(size_t size)
-{
-//  printf("\nmm_malloc called\n - Requesting %ld bytes\n", size);
-  // Ignore size 0 cases
-  if (size == 0)
+static void *carve_aligned(void *ptr, size_t asize, size_t align) {
+  size_t size = GET_SIZE(HDRP(ptr));
+  size_t front = (align - ((size_t)ptr & (align-1))) & (align-1);
+  void *aligned;
+
+  // The front part has to be big enough to be a free block
+  if (front != 0 && front < OVERHEAD * 2)
+    front += align;
+  if (front + asize > size)
     return NULL;
+  if (front == 0)
+    return ptr;
 
-  // Align block size
-  size_t asize = ALIGN(size + OVERHEAD);
-  void *ptr = first_free;
-//  printf(" - Aligned size: %ld bytes\n", asize);
+  aligned = (char *)ptr + front;
+  PUT(HDRP(ptr), PACK(front, 0));
+  PUT(FTRP(ptr), PACK(front, 0));
+  PUT(HDRP(aligned), PACK(size - front, 0));
+  PUT(FTRP(aligned), PACK(size - front, 0));
+  insert_node(aligned, size - front);
+  return aligned;
+}
+
+/*
+ * Find the first free block of at least asize bytes, with its payload
+ * on an align-byte boundary
+ * Returns NULL if there isn't one
+ */
+static void *find_fit(size_t asize, size_t align) {
+  void *ptr = first_free, *aligned;
+
+  if (align > ALIGNMENT) {
+    for (; ptr != NULL; ptr = F_NEXT(ptr))
+      if (GET_SIZE(HDRP(ptr)) >= asize
+          && (aligned = carve_aligned(ptr, asize, align)) != NULL)
+        return aligned;
+    return NULL;
+  }
 
   // Search for a free block of adequate size
   while (ptr != NULL) {
@@ -315,33 +510,350 @@ void *mm_malloc(size_t size)
       break;
     }
   }
+  return ptr;
+}
+
+/*
+ * Extend the heap by enough for an asize-byte block on an align-byte
+ * boundary
+ * Returns that block, or NULL if mem_map fails
+ */
+static void *extend_fit(size_t asize, size_t align) {
+  void *ptr;
+
+  if (align <= ALIGNMENT)
+    return extend(PAGE_ALIGN(asize + CHUNK_OVERHEAD));
+  if ((ptr = extend(PAGE_ALIGN(asize + CHUNK_OVERHEAD + 2 * align))) == NULL)
+    return NULL;
+  return carve_aligned(ptr, asize, align);
+}
+/********** End of helper functions **********/
+
+
+/********** Heap profiler **********/
+
+/*
+ * Roughly one in every sample_bytes allocated bytes is sampled: the
+ * distance between samples is drawn from an exponential distribution,
+ * so sample_countdown is the only thing mm_malloc touches when a request
+ * isn't picked. A sampled block gets SAMPLED_BIT in its header and an
+ * entry in a side table pointing at its interned backtrace. Both tables
+ * are mapped directly, so they never show up in the heap footprint.
+ */
+#define PROF_DEPTH    16        // frames kept per backtrace
+#define PROF_SAMPLES  (1<<16)   // sampled blocks that can be live at once
+#define PROF_STACKS   (1<<12)   // distinct backtraces
+
+typedef struct {
+  size_t hash;
+  int depth;
+  void *frames[PROF_DEPTH];
+  double live_bytes;   // estimated bytes allocated here and still live
+  size_t live_count;   // sampled blocks allocated here and still live
+} prof_stack;
+
+typedef struct {
+  void *ptr;           // payload of the sampled block, NULL if unused
+  double weight;       // estimated bytes this sample stands for
+  prof_stack *stack;
+} prof_sample;
+
+static long sample_countdown = LONG_MAX;
+static size_t sample_bytes = 0;
+static size_t prof_rng = 0x9E3779B97F4A7C15;
+static size_t prof_dropped = 0;
+static prof_sample *prof_samples = NULL;
+static prof_stack *prof_stacks = NULL;
+
+#define PROF_HASH(p)  ((((size_t)(p)) >> 4) * 0x9E3779B97F4A7C15)
+
+/*
+ * Draw the number of bytes until the next sample (xorshift64*)
+ */
+static long next_sample_interval(void) {
+  double u;
+  prof_rng ^= prof_rng >> 12;
+  prof_rng ^= prof_rng << 25;
+  prof_rng ^= prof_rng >> 27;
+  u = ((prof_rng * 0x2545F4914F6CDD1D) >> 11) * (1.0 / 9007199254740992.0);
+  return (long)(-log(1.0 - u) * sample_bytes) + 1;
+}
+
+/*
+ * Find the interned copy of a backtrace, adding it if it is new
+ */
+static prof_stack *intern_stack(void **frames, int depth) {
+  size_t hash = depth, i;
+  int j;
+  for (j = 0; j < depth; j++)
+    hash = (hash ^ (size_t)frames[j]) * 0x100000001B3;
+
+  for (i = hash & (PROF_STACKS-1); ; i = (i+1) & (PROF_STACKS-1)) {
+    prof_stack *st = &prof_stacks[i];
+    if (st->depth == 0) {
+      st->hash = hash;
+      st->depth = depth;
+      memcpy(st->frames, frames, depth * sizeof(void *));
+      return st;
+    }
+    if (st->hash == hash && st->depth == depth
+        && !memcmp(st->frames, frames, depth * sizeof(void *)))
+      return st;
+    if (((i+1) & (PROF_STACKS-1)) == (hash & (PROF_STACKS-1)))
+      return NULL;  // table is full
+  }
+}
+
+/*
+ * Slow path of mm_malloc once sample_countdown runs out: record the
+ * block and draw the next interval. Kept out of line so mm_malloc's fast
+ * path stays small.
+ */
+static __attribute__((noinline)) void sample_alloc(void *ptr, size_t size) {
+  void *frames[PROF_DEPTH+1];
+  prof_stack *st;
+  size_t i, n;
+  int depth;
+
+  if (sample_bytes == 0) {
+    sample_countdown = LONG_MAX;
+    return;
+  }
+  sample_countdown = next_sample_interval();
+
+  // Skip our own frame, so every stack starts at mm_malloc
+  depth = backtrace(frames, PROF_DEPTH+1) - 1;
+  if (depth <= 0 || (st = intern_stack(frames+1, depth)) == NULL) {
+    prof_dropped++;
+    return;
+  }
+
+  for (n = 0, i = PROF_HASH(ptr) & (PROF_SAMPLES-1);
+       prof_samples[i].ptr != NULL; i = (i+1) & (PROF_SAMPLES-1))
+    if (++n == PROF_SAMPLES/2) {  // keep probe sequences short
+      prof_dropped++;
+      return;
+    }
+
+  // A block of size bytes is picked with probability 1-exp(-size/rate),
+  // so weigh each sample by the inverse of that to keep sums unbiased
+  prof_samples[i].ptr = ptr;
+  prof_samples[i].weight = size / (1.0 - exp(-(double)size / sample_bytes));
+  prof_samples[i].stack = st;
+  st->live_bytes += prof_samples[i].weight;
+  st->live_count++;
+  PUT(HDRP(ptr), GET(HDRP(ptr)) | SAMPLED_BIT);
+}
+
+/*
+ * Drop a sampled block from the side table when it is freed
+ * (linear probing with backward-shift deletion)
+ */
+static void sample_free(void *ptr) {
+  size_t i, j, home;
+
+  if (prof_samples == NULL)
+    return;
+
+  for (i = PROF_HASH(ptr) & (PROF_SAMPLES-1); prof_samples[i].ptr != ptr;
+       i = (i+1) & (PROF_SAMPLES-1))
+    if (prof_samples[i].ptr == NULL)
+      return;
+
+  prof_samples[i].stack->live_bytes -= prof_samples[i].weight;
+  prof_samples[i].stack->live_count--;
+  prof_samples[i].ptr = NULL;
+
+  for (j = (i+1) & (PROF_SAMPLES-1); prof_samples[j].ptr != NULL;
+       j = (j+1) & (PROF_SAMPLES-1)) {
+    home = PROF_HASH(prof_samples[j].ptr) & (PROF_SAMPLES-1);
+    if (((j - home) & (PROF_SAMPLES-1)) >= ((j - i) & (PROF_SAMPLES-1))) {
+      prof_samples[i] = prof_samples[j];
+      prof_samples[j].ptr = NULL;
+      i = j;
+    }
+  }
+}
+
+/*
+ * Forget every sample, e.g. because the heap was reset
+ */
+static void clear_samples(void) {
+  if (prof_samples == NULL)
+    return;
+  memset(prof_samples, 0, PROF_SAMPLES * sizeof(prof_sample));
+  memset(prof_stacks, 0, PROF_STACKS * sizeof(prof_stack));
+  prof_dropped = 0;
+}
+/********** End of heap profiler **********/
+
+/* =
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+//  printf("\nmm_init called\n");
+  first_free = NULL;
+  first_chunk = NULL;
+  num_pending = 0;
+  clear_samples();
+  return 0;
+}
+
+/*
+ * Out-of-memory path of malloc_block: give back everything mm.c holds
+ * on to, then ask the application to shed memory, retrying after each
+ * step. The reclaim callback runs without heap_lock, so it may free.
+ * Returns a free block of at least asize bytes, or NULL
+ */
+static void *reclaim(size_t asize, size_t align) {
+  void *ptr;
+
+  if (bg_running)
+    drain_deferred(BG_QUEUE);
+  trim_heap(0);
+  if ((ptr = find_fit(asize, align)) != NULL
+      || (ptr = extend_fit(asize, align)) != NULL)
+    return ptr;
+
+  if (reclaim_fn == NULL)
+    return NULL;
+  if (bg_running)
+    pthread_mutex_unlock(&heap_lock);
+  size_t shed = reclaim_fn(PAGE_ALIGN(asize + CHUNK_OVERHEAD), reclaim_arg);
+  if (bg_running)
+    pthread_mutex_lock(&heap_lock);
+  if (shed == 0)
+    return NULL;
+
+  if (bg_running)
+    drain_deferred(BG_QUEUE);
+  trim_heap(0);
+  if ((ptr = find_fit(asize, align)) != NULL)
+    return ptr;
+  return extend_fit(asize, align);
+}
+
+/*
+ * Allocate a block of asize bytes with its payload on an align-byte
+ * boundary, extending the heap if no free block fits. While the
+ * background thread runs, the oldest few frees still in its queue are
+ * done before the heap is extended, and the rest stay with the thread so
+ * the request doesn't wait on a whole queue. Once the thread has fallen
+ * BG_BACKLOG frees behind, the whole queue is done first, so that frees
+ * it hasn't got to don't grow the heap.
+ */
+static void *malloc_block(size_t size, size_t asize, size_t align) {
+  void *ptr = find_fit(asize, align);
+
+  if (ptr == NULL && bg_running
+      && drain_deferred(bg_queued() > BG_BACKLOG ? BG_QUEUE : BG_INLINE))
+    ptr = find_fit(asize, align);
 
   // If a free block that fits isn't found, extend the heap
   if (ptr == NULL) {
 //    printf(" - No free blocks of adequate size.\n");
-    size_t extendsize = PAGE_ALIGN(asize);
-    if ((ptr = extend(extendsize)) == NULL)
+    if ((ptr = extend_fit(asize, align)) == NULL
+        && (ptr = reclaim(asize, align)) == NULL)
       return NULL;
   }
 
   // Allocate the block
   ptr = set_allocated(ptr, asize);
 
+  if ((sample_countdown -= size) < 0)
+    sample_alloc(ptr, size);
+
   return ptr;
 }
 
 /*
- * mm_free - Frees the block pointed to by ptr, coalescing if applicable.
- * Returns nothing.
+ * Decide whether a request gets cache-line placement: it is at least
+ * line_min bytes, or line_threads is set and mm_malloc has been called
+ * from more than one thread
  */
-void mm_free(void *ptr)
+static int use_lines(size_t size) {
+  pthread_t self;
+
+  if (line_min != 0 && size >= line_min)
+    return 1;
+  if (!line_threads)
+    return 0;
+  if (line_multi)
+    return 1;
+  self = pthread_self();
+  if (!line_seen) {
+    line_first = self;
+    line_seen = 1;
+  }
+  else if (!pthread_equal(self, line_first))
+    line_multi = 1;
+  return line_multi;
+}
+
+/*
+ * mm_malloc - Allocate a block by using bytes from current_avail,
+ *     grabbing a new page if necessary.
+ */
+void *mm_malloc(size_t size)
 {
-//  printf("\nmm_free called\n");
-  if (ptr == NULL)
-    return;
+//  printf("\nmm_malloc called\n - Requesting %ld bytes\n", size);
+  void *ptr;
+
+  // Ignore size 0 cases
+  if (size == 0)
+    return NULL;
+
+  // Align block size
+  size_t asize = ALIGN(size + OVERHEAD);
+  size_t align = ALIGNMENT;
+//  printf(" - Aligned size: %ld bytes\n", asize);
+
+  // Give the payload cache lines of its own if placement asks for it
+  if (line_mode && use_lines(size)) {
+    asize = LINE_ALIGN(size) + OVERHEAD;
+    align = LINE_SIZE;
+  }
+
+  if (!bg_running)
+    return malloc_block(size, asize, align);
+
+  pthread_mutex_lock(&heap_lock);
+  ptr = malloc_block(size, asize, align);
+  pthread_mutex_unlock(&heap_lock);
+  return ptr;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload starts on an align-byte
+ *     boundary. align must be a power of two. The bytes skipped to
+ *     reach the boundary stay free for other requests.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+  void *ptr;
+
+  if (size == 0 || (align & (align-1)) != 0)
+    return NULL;
+  if (align <= ALIGNMENT)
+    return mm_malloc(size);
+
+  HEAP_LOCK();
+  ptr = malloc_block(size, ALIGN(size + OVERHEAD), align);
+  HEAP_UNLOCK();
+  return ptr;
+}
+
+/*
+ * Free an allocated block, coalescing if applicable. The background
+ * thread passes deferred = 1 and also purges large free blocks.
+ */
+static void free_block(void *ptr, int deferred) {
   // Set the header allocated bit to 0
   block_header* hdr = (block_header *)HDRP(ptr);
   size_t size = GET_SIZE(hdr);
+  if (GET(hdr) & SAMPLED_BIT)
+    sample_free(ptr);
   PUT(hdr, PACK(size, 0));
 
   // Similar for the footer
@@ -353,7 +865,549 @@ void mm_free(void *ptr)
   // Coalesce, if applicable
   insert_node(ptr, size);
   ptr = coalesce(ptr);
-  ptr = check_chunk(ptr);
+  ptr = check_chunk(ptr, deferred);
 
-  return;
+  if (deferred && ptr != NULL && GET_SIZE(HDRP(ptr)) >= BG_PURGE_MIN)
+    purge_block(ptr);
+}
+
+/*
+ * mm_free - Frees the block pointed to by ptr, coalescing if applicable.
+ *     While the background thread runs, the block is only queued for it.
+ * Returns nothing.
+ */
+void mm_free(void *ptr)
+{
+//  printf("\nmm_free called\n");
+  if (ptr == NULL)
+    return;
+
+  if (!bg_running) {
+    free_block(ptr, 0);
+    return;
+  }
+
+  if (bg_defer(ptr))
+    return;
+  pthread_mutex_lock(&heap_lock);
+  free_block(ptr, 0);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * mm_set_placement - Start requests of at least line_min bytes (0 for
+ *     none) on cache-line boundaries, with no neighbour sharing their
+ *     lines. With threads set, do that for every request as soon as
+ *     mm_malloc sees a second thread. The bytes skipped to reach the
+ *     boundary stay free for other requests.
+ */
+void mm_set_placement(size_t min_size, int threads)
+{
+  HEAP_LOCK();
+  line_min = min_size;
+  line_threads = threads;
+  line_seen = line_multi = 0;
+  line_mode = (line_min != 0 || line_threads);
+  HEAP_UNLOCK();
+}
+
+/*
+ * mm_reserve - Add a chunk of at least bytes free bytes to the heap with
+ *     its pages already faulted in, either by mmap (MM_RESERVE_POPULATE)
+ *     or by writing to every page (MM_RESERVE_TOUCH). The chunk is kept
+ *     when it empties and by mm_trim, until the next mm_init.
+ *     Returns 0 on success, -1 if the memory can't be mapped.
+ */
+int mm_reserve(size_t bytes, int flags)
+{
+  size_t size = PAGE_ALIGN(ALIGN(bytes) + CHUNK_OVERHEAD);
+  chunk_t *chunk;
+  char *page;
+
+  HEAP_LOCK();
+  if (extend_with(size, (flags & MM_RESERVE_POPULATE) ? mem_map_populate
+                                                      : mem_map) == NULL) {
+    HEAP_UNLOCK();
+    return -1;
+  }
+  chunk = first_chunk;
+  PUT(HDRP(chunk), GET(HDRP(chunk)) | RESERVED_BIT);
+
+  // The first byte of every page is either the chunk's padding or inside
+  // its free block, so it can be written without disturbing the heap
+  if (flags & MM_RESERVE_TOUCH)
+    for (page = CHUNK_BASE(chunk); page < CHUNK_BASE(chunk) + size;
+         page += mem_pagesize())
+      *(volatile char *)page = 0;
+
+  HEAP_UNLOCK();
+  return 0;
+}
+
+/*
+ * mm_set_reclaim - Register fn to be called when the heap can't grow,
+ *     after mm.c has released everything it can itself. fn is asked for
+ *     a number of bytes and returns how many it freed; when that is
+ *     nonzero the allocation is retried. Pass NULL to unregister.
+ */
+void mm_set_reclaim(mm_reclaim_fn fn, void *arg)
+{
+  HEAP_LOCK();
+  reclaim_fn = fn;
+  reclaim_arg = arg;
+  HEAP_UNLOCK();
+}
+
+/*
+ * mm_trim - Give free memory back to the OS until at most keep_bytes of
+ *     free memory is still held. Entirely free chunks are unmapped first,
+ *     then the free pages inside partially used chunks are purged.
+ *     Returns the number of bytes released.
+ */
+size_t mm_trim(size_t keep_bytes)
+{
+  size_t released;
+
+  HEAP_LOCK();
+  released = trim_heap(keep_bytes);
+  HEAP_UNLOCK();
+  return released;
+}
+
+/*
+ * mm_profile_start - Start sampling about one in every rate allocated
+ *     bytes. Returns 0 on success, -1 if the side tables can't be mapped.
+ */
+int mm_profile_start(size_t rate)
+{
+  void *frames[1];
+
+  if (prof_samples == NULL) {
+    prof_samples = mmap(NULL, PROF_SAMPLES * sizeof(prof_sample),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    prof_stacks = mmap(NULL, PROF_STACKS * sizeof(prof_stack),
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (prof_samples == MAP_FAILED || prof_stacks == MAP_FAILED) {
+      mm_profile_stop();
+      return -1;
+    }
+  }
+  // backtrace() may allocate the first time it runs; get that out of the
+  // way before it can happen inside mm_malloc
+  backtrace(frames, 1);
+
+  sample_bytes = MAX(rate, 1);
+  sample_countdown = next_sample_interval();
+  return 0;
+}
+
+/*
+ * mm_profile_stop - Stop sampling and drop the side tables
+ */
+void mm_profile_stop(void)
+{
+  if (prof_samples != NULL && prof_samples != MAP_FAILED)
+    munmap(prof_samples, PROF_SAMPLES * sizeof(prof_sample));
+  if (prof_stacks != NULL && prof_stacks != MAP_FAILED)
+    munmap(prof_stacks, PROF_STACKS * sizeof(prof_stack));
+  prof_samples = NULL;
+  prof_stacks = NULL;
+  sample_bytes = 0;
+  sample_countdown = LONG_MAX;
+}
+
+/*
+ * A live backtrace as mm_profile_dump copies it out under heap_lock
+ */
+typedef struct {
+  prof_stack *stack;   // frames only; they don't change once interned
+  double live_bytes;
+  size_t live_count;
+} prof_entry;
+
+/*
+ * Append the printf-style text to the dump buffer, writing it out when
+ * it fills. Returns -1 if a write fails
+ */
+static int prof_put(int fd, char *buf, size_t *n, const char *fmt, ...) {
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf + *n, PROF_BUF - *n, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return -1;
+  if (*n + len < PROF_BUF) {
+    *n += len;
+    return 0;
+  }
+  // Didn't fit: write out what is there and format again at the start
+  if (*n > 0 && write(fd, buf, *n) != (ssize_t)*n)
+    return -1;
+  *n = 0;
+  va_start(ap, fmt);
+  len = vsnprintf(buf, PROF_BUF, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return -1;
+  *n = len < PROF_BUF ? (size_t)len : PROF_BUF - 1;
+  return 0;
+}
+
+/*
+ * Write out the dump buffer. Returns -1 if the write fails
+ */
+static int prof_flush(int fd, char *buf, size_t *n) {
+  ssize_t len = *n;
+
+  *n = 0;
+  return write(fd, buf, len) == len ? 0 : -1;
+}
+
+/*
+ * mm_profile_dump - Write the live heap, aggregated by allocation
+ *     backtrace and largest first, to a text file. The live backtraces
+ *     are copied out under heap_lock, since the background thread's
+ *     frees change them, and nothing here calls malloc.
+ *     Returns 0 on success, -1 on failure.
+ */
+int mm_profile_dump(const char *path)
+{
+  prof_entry *live, tmp;
+  char buf[PROF_BUF];
+  double total = 0;
+  size_t i, j, gap, n = 0, count = 0, len = 0;
+  int k, fd, err = 0;
+
+  if (prof_stacks == NULL)
+    return -1;
+  live = mmap(NULL, PROF_STACKS * sizeof(prof_entry), PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (live == MAP_FAILED)
+    return -1;
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    munmap(live, PROF_STACKS * sizeof(prof_entry));
+    return -1;
+  }
+
+  HEAP_LOCK();
+  for (i = 0; i < PROF_STACKS; i++) {
+    if (prof_stacks[i].live_count == 0)
+      continue;
+    live[n].stack = &prof_stacks[i];
+    live[n].live_bytes = prof_stacks[i].live_bytes;
+    live[n].live_count = prof_stacks[i].live_count;
+    total += live[n].live_bytes;
+    count += live[n].live_count;
+    n++;
+  }
+  HEAP_UNLOCK();
+
+  // Shell sort by decreasing size (qsort may call back into malloc)
+  for (gap = n/2; gap > 0; gap /= 2)
+    for (i = gap; i < n; i++)
+      for (j = i; j >= gap
+             && live[j-gap].live_bytes < live[j].live_bytes; j -= gap) {
+        tmp = live[j];
+        live[j] = live[j-gap];
+        live[j-gap] = tmp;
+      }
+
+  err |= prof_put(fd, buf, &len, "heap profile: %.0f bytes in %lu samples"
+                  " (1 sample per %lu bytes, %lu dropped)\n",
+                  total, count, sample_bytes, prof_dropped);
+  for (i = 0; i < n && !err; i++) {
+    err |= prof_put(fd, buf, &len, "%12.0f %8lu @", live[i].live_bytes,
+                    live[i].live_count);
+    for (k = 0; k < live[i].stack->depth; k++)
+      err |= prof_put(fd, buf, &len, " %p", live[i].stack->frames[k]);
+    err |= prof_put(fd, buf, &len, "\n");
+    err |= prof_flush(fd, buf, &len);
+    backtrace_symbols_fd(live[i].stack->frames, live[i].stack->depth, fd);
+  }
+  err |= prof_flush(fd, buf, &len);
+
+  munmap(live, PROF_STACKS * sizeof(prof_entry));
+  if (close(fd) < 0 || err)
+    return -1;
+  return 0;
+}
+
+/*
+ * mm_usable_size - Bytes that can be stored in the allocated block ptr,
+ *     which may be more than were asked for
+ */
+size_t mm_usable_size(void *ptr)
+{
+  if (ptr == NULL)
+    return 0;
+  return GET_SIZE(HDRP(ptr)) - OVERHEAD;
+}
+
+/*
+ * mm_stats - Walk every chunk and count its allocated and free blocks.
+ *     Whatever is left of chunk_bytes is sentinels and terminators.
+ */
+void mm_stats(mm_stats_t *stats)
+{
+  chunk_t *chunk;
+  void *ptr;
+
+  memset(stats, 0, sizeof(*stats));
+  HEAP_LOCK();
+  for (chunk = first_chunk; chunk != NULL; chunk = chunk->next) {
+    stats->chunks++;
+    stats->chunk_bytes += CHUNK_OVERHEAD;
+    for (ptr = CHUNK_FIRST(chunk); GET_SIZE(HDRP(ptr)) != 0;
+         ptr = NEXT_BLKP(ptr)) {
+      stats->chunk_bytes += GET_SIZE(HDRP(ptr));
+      if (GET_ALLOC(HDRP(ptr))) {
+        stats->alloc_blocks++;
+        stats->alloc_bytes += GET_SIZE(HDRP(ptr));
+      }
+      else {
+        stats->free_blocks++;
+        stats->free_bytes += GET_SIZE(HDRP(ptr));
+      }
+    }
+  }
+  HEAP_UNLOCK();
+}
+
+/*
+ * Write out the words in the snapshot buffer
+ * Returns -1 if the write fails
+ */
+static int snap_flush(int fd, size_t *buf, size_t *n) {
+  ssize_t len = *n * sizeof(size_t);
+
+  *n = 0;
+  return write(fd, buf, len) == len ? 0 : -1;
+}
+
+/*
+ * Append word to the snapshot buffer, writing it out when full
+ */
+static int snap_put(int fd, size_t *buf, size_t *n, size_t word) {
+  buf[(*n)++] = word;
+  return *n < SNAP_BUF ? 0 : snap_flush(fd, buf, n);
+}
+
+/*
+ * mm_snapshot - Write a map of the heap to path: every chunk with its
+ *     address and size, followed by the size and state of each of its
+ *     blocks. See mm.h for the layout. Uses no malloc, so the heap is
+ *     seen as the caller left it.
+ */
+int mm_snapshot(const char *path)
+{
+  size_t buf[SNAP_BUF], n = 0, chunks = 0, blocks, bytes;
+  chunk_t *chunk;
+  void *ptr;
+  int fd, err = 0;
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+
+  HEAP_LOCK();
+  for (chunk = first_chunk; chunk != NULL; chunk = chunk->next)
+    chunks++;
+  err |= snap_put(fd, buf, &n, MM_SNAP_MAGIC);
+  err |= snap_put(fd, buf, &n, chunks);
+
+  for (chunk = first_chunk; chunk != NULL && !err; chunk = chunk->next) {
+    blocks = 0;
+    bytes = CHUNK_OVERHEAD;
+    for (ptr = CHUNK_FIRST(chunk); GET_SIZE(HDRP(ptr)) != 0;
+         ptr = NEXT_BLKP(ptr)) {
+      blocks++;
+      bytes += GET_SIZE(HDRP(ptr));
+    }
+    err |= snap_put(fd, buf, &n, (size_t)CHUNK_BASE(chunk));
+    err |= snap_put(fd, buf, &n, bytes);
+    err |= snap_put(fd, buf, &n, blocks);
+    for (ptr = CHUNK_FIRST(chunk); GET_SIZE(HDRP(ptr)) != 0 && !err;
+         ptr = NEXT_BLKP(ptr))
+      err |= snap_put(fd, buf, &n,
+                      GET_SIZE(HDRP(ptr)) | GET_ALLOC(HDRP(ptr)));
+  }
+  HEAP_UNLOCK();
+
+  err |= snap_flush(fd, buf, &n);
+  if (close(fd) < 0 || err)
+    return -1;
+  return 0;
+}
+
+
+/********** Background maintenance **********/
+
+static pthread_t bg_thread;
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_wake = PTHREAD_COND_INITIALIZER;
+static void *bg_queue[BG_QUEUE];  // deferred frees, a ring under bg_lock
+static size_t bg_head = 0, bg_tail = 0;
+static int bg_release = 0;        // pending_chunks is non-empty
+static int bg_sleeping = 0;
+static int bg_stopping = 0;
+
+/*
+ * Wake the background thread. Called with heap_lock held.
+ */
+static void bg_kick(void) {
+  pthread_mutex_lock(&bg_lock);
+  bg_release = 1;
+  if (bg_sleeping)
+    pthread_cond_signal(&bg_wake);
+  pthread_mutex_unlock(&bg_lock);
+}
+
+/*
+ * Queue a block for the background thread to free
+ * Returns 0 if the queue is full
+ */
+static int bg_defer(void *ptr) {
+  int queued = 0;
+
+  pthread_mutex_lock(&bg_lock);
+  if (bg_tail - bg_head < BG_QUEUE) {
+    bg_queue[bg_tail++ % BG_QUEUE] = ptr;
+    queued = 1;
+    if (bg_sleeping)
+      pthread_cond_signal(&bg_wake);
+  }
+  pthread_mutex_unlock(&bg_lock);
+  return queued;
+}
+
+/*
+ * Number of frees waiting for the background thread
+ */
+static size_t bg_queued(void) {
+  size_t n;
+
+  pthread_mutex_lock(&bg_lock);
+  n = bg_tail - bg_head;
+  pthread_mutex_unlock(&bg_lock);
+  return n;
+}
+
+/*
+ * Take a chunk off pending_chunks before it is unmapped by someone else.
+ * Called with heap_lock held.
+ */
+static void forget_pending(chunk_t *chunk) {
+  int i;
+  for (i = 0; i < num_pending; i++)
+    if (pending_chunks[i] == chunk) {
+      pending_chunks[i] = pending_chunks[--num_pending];
+      break;
+    }
+  PUT(HDRP(chunk), GET(HDRP(chunk)) & ~PENDING_BIT);
+}
+
+/*
+ * Move up to max deferred frees out of the queue into batch
+ * Returns the number moved
+ */
+static int take_deferred(void **batch, int max) {
+  int n = 0;
+  pthread_mutex_lock(&bg_lock);
+  while (n < max && bg_head != bg_tail)
+    batch[n++] = bg_queue[bg_head++ % BG_QUEUE];
+  pthread_mutex_unlock(&bg_lock);
+  return n;
+}
+
+/*
+ * Do up to max queued frees on the caller's thread, leaving empty chunks
+ * for the background thread. Called with heap_lock held.
+ * Returns the number of blocks freed
+ */
+static int drain_deferred(int max) {
+  void *batch[BG_BATCH];
+  int i, n, total = 0;
+
+  while (total < max
+         && (n = take_deferred(batch, max - total < BG_BATCH
+                               ? max - total : BG_BATCH)) > 0) {
+    for (i = 0; i < n; i++)
+      free_block(batch[i], 0);
+    total += n;
+  }
+  return total;
+}
+
+/*
+ * Body of the background thread: free queued blocks a batch at a time,
+ * then unmap whichever queued chunks are still empty
+ */
+static void *bg_main(void *arg) {
+  void *batch[BG_BATCH];
+  chunk_t *chunk;
+  int i, n;
+
+  for (;;) {
+    pthread_mutex_lock(&bg_lock);
+    while (bg_head == bg_tail && !bg_release && !bg_stopping) {
+      bg_sleeping = 1;
+      pthread_cond_wait(&bg_wake, &bg_lock);
+      bg_sleeping = 0;
+    }
+    if (bg_head == bg_tail && !bg_release && bg_stopping) {
+      pthread_mutex_unlock(&bg_lock);
+      break;
+    }
+    bg_release = 0;
+    pthread_mutex_unlock(&bg_lock);
+
+    pthread_mutex_lock(&heap_lock);
+    n = take_deferred(batch, BG_BATCH);
+    for (i = 0; i < n; i++)
+      free_block(batch[i], 1);
+    while (num_pending > 0) {
+      chunk = pending_chunks[--num_pending];
+      PUT(HDRP(chunk), GET(HDRP(chunk)) & ~PENDING_BIT);
+      if (!GET_ALLOC(HDRP(CHUNK_FIRST(chunk))))  // not reused since
+        check_chunk(CHUNK_FIRST(chunk), 1);
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+  return arg;
+}
+
+/*
+ * mm_background_start - Move freeing and chunk release onto a background
+ *     thread. The heap must not be in use by another thread while the
+ *     background thread is started or stopped.
+ *     Returns 0 on success, -1 if the thread can't be created.
+ */
+int mm_background_start(void)
+{
+  if (bg_running)
+    return 0;
+  bg_stopping = 0;
+  bg_release = 0;
+  bg_head = bg_tail = 0;
+  if (pthread_create(&bg_thread, NULL, bg_main, NULL) != 0)
+    return -1;
+  bg_running = 1;
+  return 0;
+}
+
+/*
+ * mm_background_stop - Finish all queued work and stop the background
+ *     thread
+ */
+void mm_background_stop(void)
+{
+  if (!bg_running)
+    return;
+  pthread_mutex_lock(&bg_lock);
+  bg_stopping = 1;
+  pthread_cond_signal(&bg_wake);
+  pthread_mutex_unlock(&bg_lock);
+  pthread_join(bg_thread, NULL);
+  bg_running = 0;
 }
@@ -1,5 +1,43 @@
 #include <stdio.h>
 
+/* Block and chunk counts from a walk of the whole heap */
+typedef struct {
+  size_t chunks;        /* chunks obtained from mem_map */
+  size_t chunk_bytes;   /* bytes in those chunks */
+  size_t alloc_blocks;  /* allocated blocks */
+  size_t alloc_bytes;   /* bytes in allocated blocks, headers included */
+  size_t free_blocks;   /* free blocks */
+  size_t free_bytes;    /* bytes in free blocks */
+} mm_stats_t;
+
+/*
+ * Layout of an mm_snapshot file, all words native size_t:
+ *   MM_SNAP_MAGIC, chunk count, then for each chunk
+ *     base address, size in bytes, block count,
+ *     then one word per block in address order: size | allocated bit
+ */
+#define MM_SNAP_MAGIC ((size_t)0x50414e534d4d0001)  /* "MMSNAP", version 1 */
+
+/* Ways for mm_reserve to fault its pages in */
+#define MM_RESERVE_POPULATE 0x1  /* map with MAP_POPULATE */
+#define MM_RESERVE_TOUCH    0x2  /* write to every page */
+
+/* Called when the heap can't grow; returns the bytes it managed to free */
+typedef size_t (*mm_reclaim_fn)(size_t bytes, void *arg);
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void *mm_memalign (size_t align, size_t size);
+extern size_t mm_trim (size_t keep_bytes);
+extern void mm_set_reclaim (mm_reclaim_fn fn, void *arg);
+extern int mm_reserve (size_t bytes, int flags);
+extern void mm_set_placement (size_t min_size, int threads);
+extern int mm_profile_start (size_t rate);
+extern void mm_profile_stop (void);
+extern int mm_profile_dump (const char *path);
+extern size_t mm_usable_size (void *ptr);
+extern void mm_stats (mm_stats_t *stats);
+extern int mm_snapshot (const char *path);
+extern int mm_background_start (void);
+extern void mm_background_stop (void);
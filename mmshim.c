@@ -0,0 +1,260 @@
+/*
+ * mmshim.c - run mm.c as a program's malloc through LD_PRELOAD
+ *
+ *   unix> make mmshim.so
+ *   unix> LD_PRELOAD=./mmshim.so prog ...
+ *   unix> MMSHIM_STATS=1 LD_PRELOAD=./mmshim.so prog ...  (report at exit)
+ *
+ * mm.c, memlib.c and pagemap.c are built into the library with
+ * MEMLIB_DIRECT, so memlib maps straight from the OS and the page map
+ * keeps its tables in mmap'd memory rather than calling calloc. The
+ * page map doubles as the ownership check: a pointer on a page memlib
+ * mapped is mm's, anything else came from glibc before the shim took
+ * over and goes back to glibc.
+ *
+ * One lock serializes every call into mm. The lock is taken around
+ * fork, so the child gets a consistent heap. The heap is set up on the
+ * first call, which can come before any constructor has run.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "pagemap.h"
+
+#define EXPORT  __attribute__((visibility("default")))
+#define MAX_REQUEST  (SIZE_MAX / 2)  /* larger requests fail up front */
+
+/* glibc's allocator, for blocks it handed out before the shim */
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static pthread_mutex_t shim_lock = PTHREAD_MUTEX_INITIALIZER;
+static int shim_ready = 0;
+
+/* Counts for MMSHIM_STATS */
+static size_t calls_malloc, calls_free, calls_foreign;
+
+/*
+ * shim_init - Set up mm's heap. Called with shim_lock held.
+ */
+static void shim_init(void)
+{
+  mem_init();
+  if (mm_init() < 0)
+    abort();
+  shim_ready = 1;
+}
+
+/*
+ * owned - Whether ptr is one of mm's blocks. Called with shim_lock held.
+ */
+static int owned(void *ptr)
+{
+  return pagemap_is_mapped(ptr);
+}
+
+/*
+ * shim_alloc - Allocate size bytes aligned to align (0 for mm's usual
+ *     alignment)
+ */
+static void *shim_alloc(size_t align, size_t size)
+{
+  void *p;
+
+  if (size > MAX_REQUEST) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (size == 0)
+    size = 1; /* malloc(0) must still give a unique pointer */
+
+  pthread_mutex_lock(&shim_lock);
+  if (!shim_ready)
+    shim_init();
+  p = align ? mm_memalign(align, size) : mm_malloc(size);
+  calls_malloc++;
+  pthread_mutex_unlock(&shim_lock);
+
+  if (p == NULL)
+    errno = ENOMEM;
+  return p;
+}
+
+/*
+ * shim_prepare, shim_parent, shim_child - Hold the lock across fork
+ */
+static void shim_prepare(void)
+{
+  pthread_mutex_lock(&shim_lock);
+}
+
+static void shim_parent(void)
+{
+  pthread_mutex_unlock(&shim_lock);
+}
+
+static void shim_child(void)
+{
+  pthread_mutex_init(&shim_lock, NULL);
+}
+
+/*
+ * shim_report - Print the heap's peak size and call counts to stderr
+ */
+static void shim_report(void)
+{
+  char line[256];
+  int n;
+
+  n = snprintf(line, sizeof(line), "mmshim: peak heap %zu bytes, heap now "
+               "%zu bytes, %zu allocations, %zu frees, %zu foreign frees\n",
+               mem_peakheapsize(), mem_heapsize(), calls_malloc, calls_free,
+               calls_foreign);
+  if (n > 0 && write(2, line, n) < 0)
+    return;
+}
+
+__attribute__((constructor))
+static void shim_start(void)
+{
+  pthread_atfork(shim_prepare, shim_parent, shim_child);
+  if (getenv("MMSHIM_STATS") != NULL)
+    atexit(shim_report);
+}
+
+
+/*
+ * The interposed entry points
+ */
+
+EXPORT void *malloc(size_t size)
+{
+  return shim_alloc(0, size);
+}
+
+EXPORT void free(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+  pthread_mutex_lock(&shim_lock);
+  if (shim_ready && owned(ptr)) {
+    mm_free(ptr);
+    calls_free++;
+    pthread_mutex_unlock(&shim_lock);
+    return;
+  }
+  calls_foreign++;
+  pthread_mutex_unlock(&shim_lock);
+  __libc_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+  void *p;
+
+  if (size != 0 && nmemb > MAX_REQUEST / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if ((p = shim_alloc(0, nmemb * size)) != NULL)
+    memset(p, 0, nmemb * size);
+  return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+  void *p;
+  size_t old;
+
+  if (ptr == NULL)
+    return shim_alloc(0, size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&shim_lock);
+  if (!shim_ready || !owned(ptr)) {
+    pthread_mutex_unlock(&shim_lock);
+    return __libc_realloc(ptr, size);
+  }
+  old = mm_usable_size(ptr);
+  pthread_mutex_unlock(&shim_lock);
+
+  /* Shrinking, or growing within the block's slack, stays in place */
+  if (size <= old)
+    return ptr;
+  if ((p = shim_alloc(0, size)) == NULL)
+    return NULL;
+  memcpy(p, ptr, old);
+  free(ptr);
+  return p;
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+  if (align == 0 || (align & (align - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return shim_alloc(align, size);
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+  return memalign(align, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+  void *p;
+
+  if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+    return EINVAL;
+  if ((p = shim_alloc(align, size)) == NULL)
+    return ENOMEM;
+  *memptr = p;
+  return 0;
+}
+
+EXPORT void *valloc(size_t size)
+{
+  return shim_alloc(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+  size_t page = getpagesize();
+  return shim_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+  static size_t (*libc_usable_size)(void *);
+  size_t n;
+
+  if (ptr == NULL)
+    return 0;
+  pthread_mutex_lock(&shim_lock);
+  if (shim_ready && owned(ptr)) {
+    n = mm_usable_size(ptr);
+    pthread_mutex_unlock(&shim_lock);
+    return n;
+  }
+  pthread_mutex_unlock(&shim_lock);
+
+  if (libc_usable_size == NULL)
+    libc_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT,
+                                                 "malloc_usable_size");
+  return libc_usable_size ? libc_usable_size(ptr) : 0;
+}
@@ -1,8 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <sys/mman.h>
 #include "pagemap.h"
 
+#ifdef MEMLIB_DIRECT
+/* Under the malloc shim calloc is mm itself, so tables come from mmap */
+static void *table_alloc(size_t n, size_t size) {
+  void *p = mmap(0, n * size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+#else
+#define table_alloc calloc
+#endif
+
 /* Keep track of all mapped pages so that we can easily get a list of
    all of them --- but also efficiently add and remove from the list. */
 
@@ -22,27 +34,30 @@ static mpage ***page_maps1;
 #define PAGEMAP64_LEVEL2_BITS(p) ((((uintptr_t)(p)) >> 32) & ((PAGEMAP64_LEVEL2_SIZE) - 1))
 #define PAGEMAP64_LEVEL3_BITS(p) ((((uintptr_t)(p)) >> LOG_APAGE_SIZE) & ((PAGEMAP64_LEVEL3_SIZE) - 1))
 
-void pagemap_modify(void *p, int mapped) {
+int pagemap_modify(void *p, int mapped) {
   uintptr_t pos;
   mpage **page_maps2;
   mpage *page_maps3;
   mpage *page;
 
   if (!page_maps1) {
-    page_maps1 = calloc(PAGEMAP64_LEVEL1_SIZE, sizeof(mpage **));
+    page_maps1 = table_alloc(PAGEMAP64_LEVEL1_SIZE, sizeof(mpage **));
+    if (!page_maps1) return -1;
   }
 
   pos = PAGEMAP64_LEVEL1_BITS(p);
   page_maps2 = page_maps1[pos];
   if (!page_maps2) {
-    page_maps2 = calloc(PAGEMAP64_LEVEL2_SIZE, sizeof(mpage *));
+    page_maps2 = table_alloc(PAGEMAP64_LEVEL2_SIZE, sizeof(mpage *));
+    if (!page_maps2) return -1;
     page_maps1[pos] = page_maps2;
   }
   
   pos = PAGEMAP64_LEVEL2_BITS(p);
   page_maps3 = page_maps2[pos];
   if (!page_maps3) {
-    page_maps3 = calloc(PAGEMAP64_LEVEL3_SIZE, sizeof(mpage));
+    page_maps3 = table_alloc(PAGEMAP64_LEVEL3_SIZE, sizeof(mpage));
+    if (!page_maps3) return -1;
     page_maps2[pos] = page_maps3;
   }
 
@@ -74,6 +89,7 @@ void pagemap_modify(void *p, int mapped) {
     if (page->next)
       page->next->prev = page->prev;
   }
+  return 0;
 }
 
 int pagemap_is_mapped(void *p) {
@@ -99,3 +115,10 @@ void pagemap_for_each(page_callback f) {
   }
   all_mapped_pages = NULL;
 }
+
+/* Like pagemap_for_each, but leaves every page mapped */
+void pagemap_walk(page_callback f) {
+  mpage *p;
+  for (p = all_mapped_pages; p; p = p->next)
+    f(p->addr);
+}
@@ -0,0 +1,165 @@
+/*
+ * perfctr.c - count hardware events around a piece of code
+ *
+ * The events are opened with perf_event_open for the calling thread,
+ * in two groups: {cycles, instructions, branch misses} and {L1d, LLC,
+ * dTLB misses}. Each group is scheduled onto the PMU as a unit, so the
+ * ratios within a group (IPC, say) come from the same stretch of time
+ * even when the kernel has to multiplex. Counts are scaled up by how
+ * long each group was actually counting.
+ *
+ * Counters may be missing altogether (no PMU in a VM) or only allowed
+ * in user mode (perf_event_paranoid >= 2). perfctr_open finds out what
+ * is there; events it can't open are reported as -1.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+#define GROUPS 2
+
+#define CACHE_EVENT(cache, result) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+typedef struct {
+  uint32_t type;
+  uint64_t config;
+  int group;
+} event_t;
+
+static const event_t events[PC_EVENTS] = {
+  [PC_INSTRS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+  [PC_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+  [PC_L1D] = {PERF_TYPE_HW_CACHE,
+              CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+  [PC_LLC] = {PERF_TYPE_HW_CACHE,
+              CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+  [PC_DTLB] = {PERF_TYPE_HW_CACHE,
+               CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                           PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+  [PC_BRANCH] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0},
+};
+
+static int tried = 0;         /* perfctr_open has run */
+static int available = 0;     /* events opened */
+static int user_only = 0;     /* kernel counting was refused */
+static int fds[PC_EVENTS];    /* -1 if the event couldn't be opened */
+static int slot[PC_EVENTS];   /* position in its group's read buffer */
+static int leaders[GROUPS] = {-1, -1};
+static int members[GROUPS];   /* events opened in each group */
+static char error[128] = "";  /* why the first event failed to open */
+
+static int open_event(const event_t *ev, int leader)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = ev->type;
+  attr.config = ev->config;
+  attr.disabled = leader < 0; /* the group follows its leader */
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/*
+ * perfctr_open - Open the counters for the calling thread. Returns the
+ *   number of events that can be counted; 0 if none can, in which case
+ *   perfctr_error says why. Safe to call again.
+ */
+int perfctr_open(void)
+{
+  int i, g;
+
+  if (tried)
+    return available;
+  tried = 1;
+
+  for (i = 0; i < PC_EVENTS; i++) {
+    g = events[i].group;
+    fds[i] = open_event(&events[i], leaders[g]);
+    if (fds[i] < 0 && (errno == EACCES || errno == EPERM) && !user_only) {
+      /* Not allowed to count the kernel; settle for user mode */
+      user_only = 1;
+      fds[i] = open_event(&events[i], leaders[g]);
+    }
+    if (fds[i] < 0) {
+      if (error[0] == '\0')
+        snprintf(error, sizeof(error), "%s", strerror(errno));
+      continue;
+    }
+    if (leaders[g] < 0)
+      leaders[g] = fds[i];
+    slot[i] = members[g]++;
+    available++;
+  }
+  return available;
+}
+
+/*
+ * perfctr_user_only - Whether the counts leave out time in the kernel
+ */
+int perfctr_user_only(void)
+{
+  return user_only;
+}
+
+/*
+ * perfctr_error - Why the first event that failed couldn't be opened
+ */
+const char *perfctr_error(void)
+{
+  return error;
+}
+
+/*
+ * perfctr_start - Zero the counters and start counting
+ */
+void perfctr_start(void)
+{
+  int g;
+
+  for (g = 0; g < GROUPS; g++)
+    if (leaders[g] >= 0) {
+      ioctl(leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+/*
+ * perfctr_stop - Stop counting and store the counts since
+ *   perfctr_start, -1 for events that weren't counted
+ */
+void perfctr_stop(double counts[PC_EVENTS])
+{
+  /* nr, time enabled, time running, then a value per member */
+  uint64_t buf[GROUPS][3 + PC_EVENTS];
+  int g, i, ok[GROUPS];
+
+  for (g = 0; g < GROUPS; g++) {
+    ok[g] = 0;
+    if (leaders[g] < 0)
+      continue;
+    ioctl(leaders[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    ok[g] = read(leaders[g], buf[g], sizeof(buf[g])) > 0 && buf[g][2] > 0;
+  }
+  for (i = 0; i < PC_EVENTS; i++) {
+    g = events[i].group;
+    if (fds[i] < 0 || !ok[g])
+      counts[i] = -1;
+    else /* scale up for time the group was multiplexed out */
+      counts[i] = (double)buf[g][3 + slot[i]] * buf[g][1] / buf[g][2];
+  }
+}
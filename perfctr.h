@@ -0,0 +1,18 @@
+/*
+ * perfctr.h - hardware event counts through perf_event_open
+ */
+
+/* The events, in the order perfctr_stop reports them */
+#define PC_INSTRS   0   /* instructions retired */
+#define PC_CYCLES   1   /* core cycles */
+#define PC_L1D      2   /* L1 data cache read misses */
+#define PC_LLC      3   /* last-level cache read misses */
+#define PC_DTLB     4   /* data TLB read misses */
+#define PC_BRANCH   5   /* mispredicted branches */
+#define PC_EVENTS   6
+
+int perfctr_open(void);
+int perfctr_user_only(void);
+const char *perfctr_error(void);
+void perfctr_start(void);
+void perfctr_stop(double counts[PC_EVENTS]);
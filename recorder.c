@@ -0,0 +1,379 @@
+/*
+ * recorder.c - LD_PRELOAD interposer that logs a program's allocations
+ *
+ *   unix> make recorder.so
+ *   unix> MMREC_OUT=prog.log LD_PRELOAD=./recorder.so prog ...
+ *   unix> traces/mkrep.pl < prog.log > prog.rep
+ *
+ * Every malloc, calloc, realloc, free, posix_memalign, memalign and
+ * aligned_alloc is passed on to glibc and logged as an mmrec_t record.
+ * Each thread appends to a buffer of its own with no locking. A full
+ * buffer is pushed on a lock-free list that a background thread writes
+ * out. Buffers that are still filling are written at exit.
+ *
+ * Environment:
+ *   MMREC_OUT     log file (default mmrec.<pid>.log)
+ *   MMREC_CALLER  if set, record each call's return address
+ *
+ * A child made by fork stops recording, since the log belongs to its
+ * parent. MMREC_OUT names only the first program's log: the recorder
+ * takes it out of the environment once read, so a program it execs
+ * records to mmrec.<pid>.log instead of truncating its parent's.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * The log is an mmrec_header_t followed by mmrec_t records, each
+ * thread's in order, threads interleaved by buffer. Both are in the
+ * machine's byte order.
+ */
+#define MMREC_MAGIC  "MMREC\0\0\1"
+
+/* Kinds of logged calls */
+#define MMREC_MALLOC  'a'  /* malloc, calloc and the memaligns */
+#define MMREC_REALLOC 'r'
+#define MMREC_FREE    'f'
+
+typedef struct {
+  char magic[8];           /* MMREC_MAGIC */
+  uint64_t record_size;    /* sizeof(mmrec_t) */
+} mmrec_header_t;
+
+typedef struct {
+  uint64_t ns;             /* CLOCK_MONOTONIC time of the call */
+  uint64_t ret;            /* block returned, 0 for free or on failure */
+  uint64_t old;            /* block passed to realloc or free */
+  uint64_t size;           /* bytes asked for */
+  uint64_t caller;         /* return address, if MMREC_CALLER is set */
+  uint32_t tid;            /* calling thread */
+  uint32_t op;             /* MMREC_MALLOC, MMREC_REALLOC or MMREC_FREE */
+} mmrec_t;
+
+#define BUF_RECORDS  (1<<16)  /* records per thread buffer */
+#define FLUSH_NS     10000000 /* how often the flusher looks for buffers */
+
+/* glibc's own allocator, which the wrappers below pass calls on to */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+extern void *__libc_memalign(size_t, size_t);
+
+/* A run of records from one thread */
+typedef struct buffer {
+  struct buffer *next;     /* in the list of full buffers */
+  size_t count;            /* records filled */
+  mmrec_t recs[BUF_RECORDS];
+} buffer_t;
+
+/* What the recorder knows about one thread; never freed */
+typedef struct thread_state {
+  struct thread_state *next; /* in the list of all threads */
+  buffer_t *buf;           /* buffer being filled, or NULL */
+  uint32_t tid;
+} thread_state_t;
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+static TLS thread_state_t *self;   /* this thread's state */
+static TLS int busy;               /* inside the recorder; don't log */
+
+static int recording = 0;          /* set once the log is open */
+static int with_caller = 0;
+static int log_fd = -1;
+static pthread_t flusher;
+static pthread_key_t exit_key;     /* hands a thread's buffer over at exit */
+static buffer_t *_Atomic full_buffers = NULL;
+static thread_state_t *_Atomic all_threads = NULL;
+static volatile int stopping = 0;
+
+/*
+ * write_buffer - Write the records of buf to the log
+ */
+static void write_buffer(buffer_t *buf)
+{
+  char *p = (char *)buf->recs;
+  size_t left = buf->count * sizeof(mmrec_t);
+  ssize_t n;
+
+  while (left > 0 && (n = write(log_fd, p, left)) > 0) {
+    p += n;
+    left -= n;
+  }
+}
+
+/*
+ * new_buffer - Map an empty buffer; NULL if out of memory
+ */
+static buffer_t *new_buffer(void)
+{
+  buffer_t *buf = mmap(NULL, sizeof(buffer_t), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+  buf->next = NULL;
+  buf->count = 0;
+  return buf;
+}
+
+/*
+ * push_full - Queue a buffer for the flusher
+ */
+static void push_full(buffer_t *buf)
+{
+  buffer_t *head = full_buffers;
+
+  do
+    buf->next = head;
+  while (!__atomic_compare_exchange_n(&full_buffers, &head, buf, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * flush_full - Write out and unmap every queued buffer, oldest first
+ */
+static void flush_full(void)
+{
+  buffer_t *list = __atomic_exchange_n(&full_buffers, NULL, __ATOMIC_ACQUIRE);
+  buffer_t *rev = NULL, *next;
+
+  for (; list != NULL; list = next) {
+    next = list->next;
+    list->next = rev;
+    rev = list;
+  }
+  for (; rev != NULL; rev = next) {
+    next = rev->next;
+    write_buffer(rev);
+    munmap(rev, sizeof(buffer_t));
+  }
+}
+
+/*
+ * flusher_main - Write out full buffers as they arrive
+ */
+static void *flusher_main(void *arg)
+{
+  struct timespec nap = {0, FLUSH_NS};
+
+  busy = 1;
+  while (!stopping) {
+    nanosleep(&nap, NULL);
+    flush_full();
+  }
+  return NULL;
+}
+
+/*
+ * thread_exit - Hand an exiting thread's partial buffer to the flusher
+ */
+static void thread_exit(void *arg)
+{
+  thread_state_t *st = arg;
+  buffer_t *buf = st->buf;
+
+  st->buf = NULL;
+  if (buf != NULL)
+    push_full(buf);
+}
+
+/*
+ * get_self - This thread's state, made on its first logged call
+ */
+static thread_state_t *get_self(void)
+{
+  thread_state_t *st;
+
+  if (self != NULL)
+    return self;
+  st = mmap(NULL, sizeof(thread_state_t), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (st == MAP_FAILED)
+    return NULL;
+  st->tid = syscall(SYS_gettid);
+  st->buf = NULL;
+  st->next = all_threads;
+  while (!__atomic_compare_exchange_n(&all_threads, &st->next, st, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  pthread_setspecific(exit_key, st);
+  return self = st;
+}
+
+/*
+ * record - Log one call
+ */
+static void record(int op, void *ret, void *old, size_t size, void *caller)
+{
+  thread_state_t *st;
+  mmrec_t *r;
+  struct timespec now;
+
+  if (!recording || busy)
+    return;
+  busy = 1;
+  if ((st = get_self()) == NULL)
+    goto out;
+  if (st->buf == NULL && (st->buf = new_buffer()) == NULL)
+    goto out;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  r = &st->buf->recs[st->buf->count];
+  r->ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  r->ret = (uintptr_t)ret;
+  r->old = (uintptr_t)old;
+  r->size = size;
+  r->caller = with_caller ? (uintptr_t)caller : 0;
+  r->tid = st->tid;
+  r->op = op;
+
+  if (++st->buf->count == BUF_RECORDS) {
+    push_full(st->buf);
+    st->buf = NULL;
+  }
+ out:
+  busy = 0;
+}
+
+/*
+ * stop_in_child - A forked child doesn't record into its parent's log
+ */
+static void stop_in_child(void)
+{
+  recording = 0;
+}
+
+/*
+ * recorder_init - Open the log and start the flusher
+ */
+__attribute__((constructor))
+static void recorder_init(void)
+{
+  char path[64];
+  char *out = getenv("MMREC_OUT");
+  mmrec_header_t hdr;
+
+  busy = 1;
+  if (out == NULL) {
+    snprintf(path, sizeof(path), "mmrec.%d.log", (int)getpid());
+    out = path;
+  }
+  with_caller = getenv("MMREC_CALLER") != NULL;
+  log_fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (log_fd < 0)
+    fprintf(stderr, "recorder: can't open %s\n", out);
+  unsetenv("MMREC_OUT"); /* children inherit LD_PRELOAD, not our log */
+  if (log_fd < 0) {
+    busy = 0;
+    return;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MMREC_MAGIC, sizeof(hdr.magic));
+  hdr.record_size = sizeof(mmrec_t);
+  if (write(log_fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+      || pthread_key_create(&exit_key, thread_exit) != 0
+      || pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+    fprintf(stderr, "recorder: can't start\n");
+    busy = 0;
+    return;
+  }
+  pthread_atfork(NULL, NULL, stop_in_child);
+  recording = 1;
+  busy = 0;
+}
+
+/*
+ * recorder_fini - Write out everything still buffered
+ */
+__attribute__((destructor))
+static void recorder_fini(void)
+{
+  thread_state_t *st;
+
+  if (!recording)
+    return;
+  busy = 1;
+  recording = 0;
+  stopping = 1;
+  pthread_join(flusher, NULL);
+  flush_full();
+
+  /* Threads still running may have partly filled buffers */
+  for (st = all_threads; st != NULL; st = st->next)
+    if (st->buf != NULL)
+      write_buffer(st->buf);
+  close(log_fd);
+}
+
+
+/*
+ * The interposed entry points
+ */
+
+void *malloc(size_t size)
+{
+  void *p = __libc_malloc(size);
+  record(MMREC_MALLOC, p, NULL, size, __builtin_return_address(0));
+  return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  void *p = __libc_calloc(nmemb, size);
+  record(MMREC_MALLOC, p, NULL, p ? nmemb * size : 0,
+         __builtin_return_address(0));
+  return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+  void *p = __libc_realloc(old, size);
+  record(MMREC_REALLOC, p, old, size, __builtin_return_address(0));
+  return p;
+}
+
+void free(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+  record(MMREC_FREE, NULL, ptr, 0, __builtin_return_address(0));
+  __libc_free(ptr);
+}
+
+void *memalign(size_t align, size_t size)
+{
+  void *p = __libc_memalign(align, size);
+  record(MMREC_MALLOC, p, NULL, size, __builtin_return_address(0));
+  return p;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+  void *p = __libc_memalign(align, size);
+  record(MMREC_MALLOC, p, NULL, size, __builtin_return_address(0));
+  return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+  void *p;
+
+  if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+    return EINVAL;
+  if ((p = __libc_memalign(align, size)) == NULL)
+    return ENOMEM;
+  record(MMREC_MALLOC, p, NULL, size, __builtin_return_address(0));
+  *memptr = p;
+  return 0;
+}
@@ -72,6 +72,8 @@ while ($line = <STDIN>) {
     $linenum++;
 
     ($cmd, $id, $size) = split(" ", $line);
+    ($cmd, $id, $size) = ($id, $size, (split(" ", $line))[3])
+	if ($cmd =~ /^\d+$/);  # skip a thread column
 
     # ignore blank lines
     if (!$cmd) {
@@ -0,0 +1,167 @@
+#!/usr/bin/perl 
+#!/usr/local/bin/perl 
+use Getopt::Std;
+
+#######################################################################
+# mkrep - turn a recorder.so allocation log into a balanced trace file
+#
+# Reads the log written by recorder.so on stdin and writes a Malloc Lab
+# trace on stdout. Calls from all threads are merged in time order,
+# each block gets the next dense id, and blocks still live at the end
+# are freed, so the trace is balanced.
+#
+#   - free and realloc of blocks allocated before recording began are
+#     dropped (a realloc of one becomes an allocation)
+#   - failed calls are dropped, and realloc(p, 0) becomes a free
+#   - zero-byte requests become one-byte requests, since mdriver
+#     needs a payload to check
+#   - an address handed out again before its free was logged (another
+#     thread's realloc can race with its own record) is freed first
+#
+# The suggested heap size in the header is the peak live payload.
+# With -t each request line starts with the number of the thread that
+# made it, threads numbered from 0 in order of their first call.
+#######################################################################
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage 
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hst]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h          Print this message\n";
+    printf STDERR "  -s          Print a summary of the log on stderr\n";
+    printf STDERR "  -t          Start each request with its thread number\n";
+    die "\n" ;
+}
+
+getopts('hst');
+if ($opt_h) {
+    usage("");
+}
+
+binmode STDIN;
+$RECSIZE = 48;
+
+#
+# Read the header and the records
+#
+read(STDIN, $hdr, 16) == 16 or die "$0: Log is too short\n";
+($magic, $recsize) = unpack("a8 Q", $hdr);
+$magic eq "MMREC\0\0\1" or die "$0: Not a recorder log\n";
+$recsize == $RECSIZE or die "$0: Records are $recsize bytes, not $RECSIZE\n";
+
+@recs = ();
+while (($n = read(STDIN, $rec, $RECSIZE)) == $RECSIZE) {
+    push @recs, [unpack("Q Q Q Q Q L L", $rec)];
+}
+$n == 0 or die "$0: Log ends in a partial record\n";
+
+# Fields of a record
+($NS, $RET, $OLD, $SIZE, $CALLER, $TID, $OP) = (0 .. 6);
+
+#
+# Merge the threads in time order; sort keeps each thread's order on ties
+#
+@order = sort { $recs[$a][$NS] <=> $recs[$b][$NS] } (0 .. $#recs);
+
+#
+# Turn addresses into ids
+#
+%id = ();       # live address -> id
+%size = ();     # live id -> size
+@lines = ();
+$ids = 0;
+$live = 0;
+$peak = 0;
+$dropped = 0;
+%threads = ();
+
+foreach $i (@order) {
+    ($ns, $ret, $old, $size, $caller, $tid, $op) = @{$recs[$i]};
+    $threads{$tid} = scalar(keys %threads) if (!exists($threads{$tid}));
+    $pre = $opt_t ? "$threads{$tid} " : "";
+    $size = 1 if ($size == 0);
+    $op = chr($op);
+
+    # realloc(NULL, n) is malloc(n), and realloc of an unknown block
+    # allocates a new one
+    if ($op eq "r" && ($old == 0 || !exists($id{$old}))) {
+	$op = "a";
+	$dropped++ if ($old != 0);
+    }
+
+    if ($op eq "a") {
+	if ($ret == 0) {
+	    $dropped++;
+	    next;
+	}
+	free_addr($ret) if (exists($id{$ret}));
+	$id{$ret} = $ids;
+	$size{$ids} = $size;
+	$live += $size;
+	push @lines, "${pre}a $ids $size";
+	$ids++;
+    }
+    elsif ($op eq "r") {
+	$rid = $id{$old};
+	if ($ret == 0) {
+	    # realloc(p, 0) frees p; a failed realloc leaves it alone
+	    free_addr($old) if ($recs[$i][$SIZE] == 0);
+	    $dropped++ if ($recs[$i][$SIZE] != 0);
+	    next;
+	}
+	delete $id{$old};
+	free_addr($ret) if (exists($id{$ret}));
+	$id{$ret} = $rid;
+	$live += $size - $size{$rid};
+	$size{$rid} = $size;
+	push @lines, "${pre}r $rid $size";
+    }
+    elsif ($op eq "f") {
+	if (!exists($id{$old})) {
+	    $dropped++;
+	    next;
+	}
+	free_addr($old);
+    }
+    else {
+	die "$0: Bad op ($op) in record $i\n";
+    }
+    $peak = $live if ($live > $peak);
+}
+
+# Balance the trace, from the first thread
+$pre = $opt_t ? "0 " : "";
+foreach $addr (sort { $id{$a} <=> $id{$b} } keys %id) {
+    free_addr($addr);
+}
+
+$ops = scalar(@lines);
+print "$peak\n$ids\n$ops\n1\n";
+foreach $line (@lines) {
+    print "$line\n";
+}
+
+if ($opt_s) {
+    printf STDERR "%d records from %d threads: %d ids, %d ops, " .
+	"%d records dropped, peak live %d bytes\n",
+	scalar(@recs), scalar(keys %threads), $ids, $ops, $dropped, $peak;
+}
+exit;
+
+#
+# free_addr(addr) - emit the free of the block at addr
+#
+sub free_addr
+{
+    my $addr = $_[0];
+    my $fid = $id{$addr};
+
+    push @lines, "${pre}f $fid";
+    $live -= $size{$fid};
+    delete $size{$fid};
+    delete $id{$addr};
+}
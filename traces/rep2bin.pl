@@ -0,0 +1,75 @@
+#!/usr/bin/perl 
+#!/usr/local/bin/perl 
+
+#######################################################################
+# rep2bin - convert a Malloc Lab trace file to the binary trace format
+#
+# Reads a .rep trace on stdin and writes the binary form on stdout.
+# mdriver maps binary traces instead of parsing them. The layout, all
+# integers little-endian:
+#
+#   header:  "MMTRACE" and a version byte (1), then five 64-bit words:
+#            suggested heap size, number of ids, number of ops, weight,
+#            and the number of bytes of op records that follow
+#   records: one per op, a type byte ('a', 'r' or 'f'), the id as a
+#            varint, and for 'a' and 'r' the size as a varint
+#
+# A varint holds 7 bits per byte, low bits first, with the top bit set
+# on every byte but the last.
+#
+# Binary traces have no thread column; one on a request line is dropped.
+#######################################################################
+
+binmode STDOUT;
+
+#
+# varint(n) - encode n as a varint
+#
+sub varint
+{
+    my $n = $_[0];
+    my $s = "";
+
+    while ($n >= 0x80) {
+	$s .= chr(($n & 0x7f) | 0x80);
+	$n >>= 7;
+    }
+    return $s . chr($n);
+}
+
+#
+# Read the four header lines
+#
+for ($i = 0; $i < 4; $i++) {
+    defined($line = <STDIN>) or die "$0: Trace header is too short\n";
+    ($header[$i]) = ($line =~ /^\s*(\d+)\s*$/)
+	or die "$0: Bad header line: $line";
+}
+($heap_size, $num_ids, $num_ops, $weight) = @header;
+
+#
+# Encode the requests
+#
+$records = "";
+$ops = 0;
+while ($line = <STDIN>) {
+    next if ($line =~ /^\s*$/);
+    $line =~ s/^\s*\d+\s+//;  # the binary format has no thread column
+    if ($line =~ /^\s*([ar])\s+(\d+)\s+(\d+)\s*$/) {
+	$records .= $1 . varint($2) . varint($3);
+    }
+    elsif ($line =~ /^\s*f\s+(\d+)\s*$/) {
+	$records .= "f" . varint($1);
+    }
+    else {
+	die "$0: Bad request line: $line";
+    }
+    $ops++;
+}
+$ops == $num_ops
+    or die "$0: Header says $num_ops ops but the trace has $ops\n";
+
+print "MMTRACE\x01";
+print pack("Q<5", $heap_size, $num_ids, $num_ops, $weight, length($records));
+print $records;
+exit;